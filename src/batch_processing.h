@@ -5,8 +5,10 @@
 #include <atomic>
 #include <future>
 #include <chrono>
+#include <memory>
 
 #include "../dep/queue/concurrentqueue.h"
+#include "memory_policy.h"
 
 
 namespace mc {
@@ -29,6 +31,7 @@ public:
 
     batch_processing_options():
         numWorkers_{0},
+        numaNodes_{},
         queueSize_{1},
         batchSize_{1},
         handleErrors_{[](std::exception&){}},
@@ -37,10 +40,14 @@ public:
     {}
 
     int concurrency()        const noexcept { return numWorkers_; }
+    const std::vector<unsigned>& numa_nodes() const noexcept { return numaNodes_; }
     std::size_t batch_size() const noexcept { return batchSize_; }
     std::size_t queue_size() const noexcept { return queueSize_; }
 
     void concurrency(int n)        noexcept { numWorkers_ = n >= 0 ? n : 0; }
+    /// @brief if more than one node is given,
+    ///        worker i is bound to NUMA node nodes[i % nodes.size()]
+    void numa_nodes(std::vector<unsigned> nodes) { numaNodes_ = std::move(nodes); }
     void batch_size(std::size_t n) noexcept { batchSize_  = n > 0 ? n : 1; }
     void queue_size(std::size_t n) noexcept { queueSize_  = n > 0 ? n : 1; }
 
@@ -50,6 +57,7 @@ public:
 
 private:
     int numWorkers_;
+    std::vector<unsigned> numaNodes_;
     std::size_t queueSize_;
     std::size_t batchSize_;
     error_handler handleErrors_;
@@ -112,6 +120,12 @@ public:
             workers_.reserve(param_.concurrency());
             for(int i = 0; i < param_.concurrency(); ++i) {
                 workers_.emplace_back(std::async(std::launch::async, [&,i] {
+                    std::unique_ptr<numa_node_binding> binding;
+                    const auto& nodes = param_.numa_nodes();
+                    if(nodes.size() > 1) {
+                        binding = std::make_unique<numa_node_binding>(
+                                      nodes[std::size_t(i) % nodes.size()]);
+                    }
                     batch_type batch;
                     validate();
                     while(valid() || workQueue_.size_approx() > 0) {
@@ -26,77 +26,111 @@
 #include <memory>
 #include <algorithm>
 #include <iostream>
-//#include <mutex>
+#include <type_traits>
+#include <cstdint>
+#include <mutex>
+
+#include "memory_policy.h"
 
 
 namespace mc {
 
 /*************************************************************************//**
  *
- *
+ * @brief contiguous memory block that hands out consecutive buffers
  *
  *****************************************************************************/
 template<class T>
-class chunk_allocator
+class memory_chunk
 {
-
-    class chunk  {
-    public:
-        explicit
-        chunk(std::size_t size) noexcept :
-            mem_{nullptr}, bof_{nullptr}, end_{nullptr}
+public:
+    explicit
+    memory_chunk(std::size_t size) noexcept :
+        mem_{nullptr}, bof_{nullptr}, end_{nullptr}
+    {
+        //large chunks follow the current memory policy
+        if(std::is_trivially_default_constructible<T>::value &&
+           size * sizeof(T) >= min_large_allocation_size())
         {
-            try {
-                bof_ = new T[size];
-                mem_.reset(bof_);
-                end_ = bof_ + size;
-            } catch (std::exception&) {
-                bof_ = nullptr;
-            }
+            const auto bytes = size * sizeof(T);
+            bof_ = static_cast<T*>(allocate_pages(bytes));
+            if(!bof_) return;
+            mem_.reset(bof_, [bytes](T* p) { deallocate_pages(p, bytes); });
+            end_ = bof_ + size;
+            return;
+        }
+        try {
+            bof_ = new T[size];
+            mem_.reset(bof_, std::default_delete<T[]>{});
+            end_ = bof_ + size;
+        } catch (std::exception&) {
+            bof_ = nullptr;
         }
+    }
 
-        chunk(const chunk&):
-            mem_{nullptr}, bof_{nullptr}, end_{nullptr}
-        {}
+    /// @brief takes (shared) ownership of 'size' already used elements
+    explicit
+    memory_chunk(std::shared_ptr<T> mem, std::size_t size) noexcept :
+        mem_{std::move(mem)}, bof_{nullptr}, end_{nullptr}
+    {
+        bof_ = mem_.get() + size;
+        end_ = bof_;
+    }
 
-        chunk(chunk&& src) noexcept :
-            mem_{std::move(src.mem_)}, bof_{src.bof_}, end_{src.end_}
-        {
-            src.bof_ = nullptr;
-            src.end_ = nullptr;
-        }
+    memory_chunk(const memory_chunk&):
+        mem_{nullptr}, bof_{nullptr}, end_{nullptr}
+    {}
 
-        chunk& operator = (const chunk& src) = delete;
+    memory_chunk(memory_chunk&& src) noexcept :
+        mem_{std::move(src.mem_)}, bof_{src.bof_}, end_{src.end_}
+    {
+        src.bof_ = nullptr;
+        src.end_ = nullptr;
+    }
 
-        chunk& operator = (chunk&& src) noexcept {
-            mem_.swap(src.mem_);
-            std::swap(src.bof_, bof_);
-            std::swap(src.end_, end_);
-            return *this;
-        }
+    memory_chunk& operator = (const memory_chunk& src) = delete;
 
-        T* begin()      const noexcept { return mem_.get(); }
-        T* begin_free() const noexcept { return bof_; }
-        T* end()        const noexcept { return end_; }
+    memory_chunk& operator = (memory_chunk&& src) noexcept {
+        mem_.swap(src.mem_);
+        std::swap(src.bof_, bof_);
+        std::swap(src.end_, end_);
+        return *this;
+    }
 
-        std::size_t total_size() const noexcept { return end() - begin(); }
-        std::size_t used_size()  const noexcept { return begin_free() - begin(); }
-        std::size_t free_size()  const noexcept { return end() - begin_free(); }
+    T* begin()      const noexcept { return mem_.get(); }
+    T* begin_free() const noexcept { return bof_; }
+    T* end()        const noexcept { return end_; }
 
-        bool owns(const T* p) const noexcept { return p >= begin() && p < end(); }
+    std::size_t total_size() const noexcept { return end() - begin(); }
+    std::size_t used_size()  const noexcept { return begin_free() - begin(); }
+    std::size_t free_size()  const noexcept { return end() - begin_free(); }
 
-        T* next_buffer(std::size_t n) noexcept {
-            if(free_size() < n) return nullptr;
-            auto p = bof_;
-            bof_ += n;
-            return p;
-        }
+    bool owns(const T* p) const noexcept { return p >= begin() && p < end(); }
+
+    T* next_buffer(std::size_t n) noexcept {
+        if(free_size() < n) return nullptr;
+        auto p = bof_;
+        bof_ += n;
+        return p;
+    }
+
+private:
+    std::shared_ptr<T> mem_;
+    T* bof_;
+    T* end_;
+};
 
-    private:
-        std::unique_ptr<T[]> mem_;
-        T* bof_;
-        T* end_;
-    };
+
+
+/*************************************************************************//**
+ *
+ *
+ *
+ *****************************************************************************/
+template<class T>
+class chunk_allocator
+{
+    using chunk = memory_chunk<T>;
 
 public:
     using value_type = T;
@@ -141,6 +175,18 @@ public:
         return (freeSize_ >= total);
     }
 
+    /**
+     * @brief takes (shared) ownership of an already initialized array
+     *        (e.g. a memory-mapped file region) with 'n' elements;
+     *        the array will not be used for subsequent allocations
+     */
+    bool adopt(std::shared_ptr<T> mem, std::size_t n)
+    {
+        if(!mem) return false;
+        chunks_.emplace_back(std::move(mem), n);
+        return true;
+    }
+
     T* allocate(std::size_t n)
     {
 //        std::lock_guard<std::mutex> lock(mutables_);
@@ -214,6 +260,332 @@ bool operator != (const chunk_allocator<T>& a, const chunk_allocator<T>& b) {
 }
 
 
+
+
+namespace detail {
+
+/*************************************************************************//**
+ *
+ * @brief process-wide table that maps 32-bit handles to addresses of
+ *        elements of type T;
+ *        a handle consists of a window index (upper bits) and
+ *        an offset within the window (lower bits)
+ *
+ *****************************************************************************/
+template<class T>
+struct chunk_handle_registry
+{
+    static constexpr int offset_bits = 20;
+    static constexpr std::size_t window_size = std::size_t(1) << offset_bits;
+    static constexpr std::size_t num_windows = std::size_t(1) << (32 - offset_bits);
+
+    //-----------------------------------------------------
+    /**
+     * @brief  assigns 'n' consecutive windows to the memory at 'base'
+     * @return index of the first window; 0 if not enough windows are left
+     */
+    static std::uint32_t acquire(T* base, std::size_t n, bool adopted)
+    {
+        std::lock_guard<std::mutex> lock(mutables);
+        //first window => null handle, last window => reserved handles
+        std::size_t run = 0;
+        for(std::size_t i = 1; i < num_windows - 1; ++i) {
+            if(bases[i]) {
+                run = 0;
+            }
+            else if(++run == n) {
+                const auto first = i + 1 - n;
+                for(std::size_t k = 0; k < n; ++k) {
+                    bases[first+k] = base + k * window_size;
+                    foreign[first+k] = adopted;
+                }
+                return std::uint32_t(first);
+            }
+        }
+        return 0;
+    }
+
+    //-----------------------------------------------------
+    static void release(std::uint32_t first, std::size_t n)
+    {
+        std::lock_guard<std::mutex> lock(mutables);
+        for(std::size_t k = first; k < first + n; ++k) {
+            bases[k] = nullptr;
+            foreign[k] = false;
+        }
+    }
+
+    //-----------------------------------------------------
+    static std::size_t free_windows()
+    {
+        std::lock_guard<std::mutex> lock(mutables);
+        std::size_t n = 0;
+        for(std::size_t i = 1; i < num_windows - 1; ++i) {
+            if(!bases[i]) ++n;
+        }
+        return n;
+    }
+
+    //-----------------------------------------------------
+    static T* bases[num_windows];
+    /// @brief windows with adopted (not allocated) memory
+    static bool foreign[num_windows];
+    static std::mutex mutables;
+};
+
+template<class T>
+T* chunk_handle_registry<T>::bases[chunk_handle_registry<T>::num_windows] = {};
+
+template<class T>
+bool chunk_handle_registry<T>::foreign[chunk_handle_registry<T>::num_windows] = {};
+
+template<class T>
+std::mutex chunk_handle_registry<T>::mutables;
+
+} // namespace detail
+
+
+
+
+/*************************************************************************//**
+ *
+ * @brief allocates arrays from large memory chunks and identifies them
+ *        by 32-bit handles instead of pointers, so that containers can
+ *        store compact references to their arrays
+ *
+ * @details At most 2^32 elements can be addressed. This limit is shared
+ *          by all allocators of the same element type in a process
+ *          (e.g. by copies of a container), since handles are resolved
+ *          without knowing the allocator.
+ *          Allocation and deallocation are not synchronized.
+ *          Deallocated arrays are reused for arrays of the same size.
+ *
+ *****************************************************************************/
+template<class T>
+class chunk_handle_allocator
+{
+    using registry = detail::chunk_handle_registry<T>;
+
+    /// @brief memory chunk with its windows in the handle registry
+    struct chunk {
+        explicit
+        chunk(memory_chunk<T>&& m, std::uint32_t firstWindow, std::size_t n) noexcept :
+            mem{std::move(m)}, first{firstWindow}, windows{n}
+        {}
+
+        chunk(chunk&& src) noexcept :
+            mem{std::move(src.mem)}, first{src.first}, windows{src.windows}
+        {
+            src.windows = 0;
+        }
+
+        chunk& operator = (chunk&& src) noexcept {
+            std::swap(mem, src.mem);
+            std::swap(first, src.first);
+            std::swap(windows, src.windows);
+            return *this;
+        }
+
+        ~chunk() {
+            if(windows > 0) registry::release(first, windows);
+        }
+
+        memory_chunk<T> mem;
+        std::uint32_t first;
+        std::size_t windows;
+    };
+
+public:
+    using value_type  = T;
+    using handle_type = std::uint32_t;
+
+    //---------------------------------------------------------------
+    /// @brief handle value that is never returned by 'allocate_handle'
+    static constexpr handle_type
+    reserved_handle(std::uint32_t i) noexcept {
+        return ~handle_type(0) - i;
+    }
+
+    //---------------------------------------------------------------
+    static T* address(handle_type h) noexcept {
+        return registry::bases[h >> registry::offset_bits]
+               + (h & (registry::window_size - 1));
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @return true, if 'n' more elements can get handles in this process;
+     *         allows for the unused ends of windows
+     */
+    static bool addressable(std::size_t n) {
+        return window_count(n + n / 16) < registry::free_windows();
+    }
+
+    //---------------------------------------------------------------
+    chunk_handle_allocator():
+        chunks_{}, current_(0), freeLists_{}
+    {}
+
+    chunk_handle_allocator(const chunk_handle_allocator&):
+        chunk_handle_allocator{}
+    {}
+
+    chunk_handle_allocator(chunk_handle_allocator&&) = default;
+
+    chunk_handle_allocator& operator = (const chunk_handle_allocator&) {
+        return *this;
+    }
+
+    chunk_handle_allocator& operator = (chunk_handle_allocator&&) = default;
+
+
+    //---------------------------------------------------------------
+    bool reserve(std::size_t total)
+    {
+        if(free_size() >= total) return true;
+        return add_chunk(std::max(total, std::size_t(registry::window_size)));
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief takes (shared) ownership of an already initialized array
+     *        (e.g. a memory-mapped file region) with 'n' elements;
+     *        the array will not be used for subsequent allocations
+     */
+    bool adopt(std::shared_ptr<T> mem, std::size_t n)
+    {
+        if(!mem) return false;
+        const auto base = mem.get();
+        const auto windows = window_count(n);
+        const auto first = registry::acquire(base, windows, true);
+        if(!first) return false;
+        auto m = memory_chunk<T>{std::move(mem), n};
+        chunks_.emplace_back(std::move(m), first, windows);
+        return true;
+    }
+
+
+    //---------------------------------------------------------------
+    /// @return handle of an array with 'n' elements; 0 on failure
+    handle_type allocate_handle(std::size_t n)
+    {
+        if(n < freeLists_.size() && !freeLists_[n].empty()) {
+            const auto h = freeLists_[n].back();
+            freeLists_[n].pop_back();
+            return h;
+        }
+        if(free_size() < n) {
+            if(!add_chunk(std::max(n, std::size_t(registry::window_size)))) return 0;
+        }
+        auto& c = chunks_[current_];
+        const auto p = c.mem.next_buffer(n);
+        return (handle_type(c.first) << registry::offset_bits)
+               + handle_type(p - c.mem.begin());
+    }
+
+    //---------------------------------------------------------------
+    void deallocate_handle(handle_type h, std::size_t n)
+    {
+        if(!h || n < 1 || n > max_recycled_size()) return;
+        if(registry::foreign[h >> registry::offset_bits]) return;
+
+        if(n >= freeLists_.size()) freeLists_.resize(n+1);
+        freeLists_[n].push_back(h);
+    }
+
+
+    //---------------------------------------------------------------
+    T* allocate(std::size_t n) {
+        const auto h = allocate_handle(n);
+        return h ? address(h) : nullptr;
+    }
+
+    //---------------------------------------------------------------
+    void deallocate(T* p, std::size_t n) {
+        deallocate_handle(handle(p), n);
+    }
+
+
+    //---------------------------------------------------------------
+    /// @return handle of an element in this allocator's memory; 0 otherwise
+    handle_type handle(const T* p) const noexcept
+    {
+        if(!p) return 0;
+        for(const auto& c : chunks_) {
+            if(c.mem.owns(p)) {
+                return (handle_type(c.first) << registry::offset_bits)
+                       + handle_type(p - c.mem.begin());
+            }
+        }
+        return 0;
+    }
+
+
+    //---------------------------------------------------------------
+    chunk_handle_allocator
+    select_on_container_copy_construction() const {
+        //don't propagate
+        return chunk_handle_allocator{};
+    }
+
+
+private:
+    //---------------------------------------------------------------
+    static constexpr std::size_t max_recycled_size() noexcept {
+        return std::size_t(1) << 16;
+    }
+
+    //---------------------------------------------------------------
+    static std::size_t window_count(std::size_t n) noexcept {
+        return std::max(std::size_t(1),
+            (n + registry::window_size - 1) / registry::window_size);
+    }
+
+    //---------------------------------------------------------------
+    std::size_t free_size() const noexcept {
+        return chunks_.empty() ? 0 : chunks_[current_].mem.free_size();
+    }
+
+    //---------------------------------------------------------------
+    /// @brief new chunk for subsequent allocations
+    bool add_chunk(std::size_t n)
+    {
+        auto m = memory_chunk<T>{n};
+        if(!m.begin()) return false;
+        const auto windows = window_count(n);
+        const auto first = registry::acquire(m.begin(), windows, false);
+        if(!first) return false;
+        chunks_.emplace_back(std::move(m), first, windows);
+        current_ = chunks_.size() - 1;
+        return true;
+    }
+
+    //---------------------------------------------------------------
+    std::vector<chunk> chunks_;
+    std::size_t current_;
+    std::vector<std::vector<handle_type>> freeLists_;
+};
+
+
+
+//-------------------------------------------------------------------
+template<class T>
+bool operator == (const chunk_handle_allocator<T>& a,
+                  const chunk_handle_allocator<T>& b)
+{
+    return (&a == &b);
+}
+
+//-------------------------------------------------------------------
+template<class T>
+bool operator != (const chunk_handle_allocator<T>& a,
+                  const chunk_handle_allocator<T>& b)
+{
+    return !(a == b);
+}
+
+
 } // namespace mc
 
 #endif
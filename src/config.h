@@ -100,7 +100,41 @@ using sketcher = single_function_unique_min_hasher<kmer_type,sketching_hash>;
  *              is mostly implemented as the identity function
  */
 //using feature_hash = std::hash<typename sketcher::feature_type>;
-using feature_hash = same_size_hash<typename sketcher::feature_type>;
+//using feature_hash = same_size_hash<typename sketcher::feature_type>;
+/// function can be chosen per database (see 'int_hash')
+using feature_hash = selectable_hash<typename sketcher::feature_type>;
+
+
+/**************************************************************************
+ * @brief collision resolution of the database hash multi-map;
+ *        cuckoo probing moves buckets of other keys during insertion,
+ *        so building and loading databases then use only one thread
+ *        for the hash table and incremental rehashing is not available;
+ *        forward declarations (see "hash_multimap.h")
+ */
+struct single_pass_quadratic_probing;
+struct cuckoo_probing;
+
+//using feature_probing = cuckoo_probing;
+using feature_probing = single_pass_quadratic_probing;
+
+
+/**************************************************************************
+ * @brief memory of the location lists in the database hash multi-map;
+ *        with compact buckets hash table slots refer to their location
+ *        lists with 32-bit handles instead of pointers (12 instead of
+ *        16 bytes per slot with default settings), but a database can
+ *        then only hold up to 2^32 locations;
+ *        forward declarations (see "chunk_allocator.h")
+ */
+template<class T> class chunk_allocator;
+template<class T> class chunk_handle_allocator;
+
+#ifdef MC_COMPACT_BUCKETS
+    template<class T> using feature_value_allocator = chunk_handle_allocator<T>;
+#else
+    template<class T> using feature_value_allocator = chunk_allocator<T>;
+#endif
 
 
 /**************************************************************************
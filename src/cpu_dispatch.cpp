@@ -0,0 +1,161 @@
+/******************************************************************************
+ *
+ * MetaCache - Meta-Genomic Classification Tool
+ *
+ * Copyright (C) 2016-2020 André Müller (muellan@uni-mainz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+// AVX-512 kernels are compiled with function target attributes,
+// so the rest of the program can stay at the baseline instruction set
+#if (defined(__GNUC__) || defined(__clang__)) && defined(__x86_64__)
+    #define MC_CPU_DISPATCH_X86
+    #include <immintrin.h>
+#endif
+
+#include "cpu_dispatch.h"
+#include "dna_encoding.h"
+
+
+namespace mc {
+
+
+namespace detail {
+//constant-initialized, so usable before the kernel selection below
+encode_2bit_block_function encode_2bit_block_kernel = &encode_2bit_block_baseline;
+}
+
+
+
+//-------------------------------------------------------------------
+namespace {
+
+#ifdef MC_CPU_DISPATCH_X86
+
+//-------------------------------------------------------------------
+/// @brief interleaves bit planes (bit i of 'lo'/'hi' => bit 2i/2i+1)
+__attribute__((target("bmi2")))
+inline std::uint64_t
+interleave_bits(std::uint32_t lo, std::uint32_t hi) noexcept
+{
+    return _pdep_u64(lo, 0x5555555555555555ull) |
+           _pdep_u64(hi, 0xAAAAAAAAAAAAAAAAull);
+}
+
+
+//-------------------------------------------------------------------
+/**
+ * @brief 64 letters per AVX-512 compare; the result masks are bit planes
+ *        of the codes which are interleaved with pdep
+ */
+__attribute__((target("avx512f,avx512bw,bmi2")))
+void encode_2bit_block_avx512(const char* first, int n,
+                              std::uint64_t (&codes)[2], std::uint64_t& ambig)
+{
+    if(n < 64) {
+        encode_2bit_block_baseline(first, n, codes, ambig);
+        return;
+    }
+
+    const __m512i v = _mm512_or_si512(_mm512_set1_epi8(0x20),
+                                      _mm512_loadu_si512(first));
+
+    const std::uint64_t isA = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('a'));
+    const std::uint64_t isC = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('c'));
+    const std::uint64_t isG = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('g'));
+    const std::uint64_t isT = _mm512_cmpeq_epi8_mask(v, _mm512_set1_epi8('t'));
+
+    const auto lo = isC | isT;
+    const auto hi = isG | isT;
+
+    codes[0] = interleave_bits(std::uint32_t(lo), std::uint32_t(hi));
+    codes[1] = interleave_bits(std::uint32_t(lo >> 32), std::uint32_t(hi >> 32));
+    ambig = ~(isA | isC | isG | isT);
+}
+
+#endif
+
+
+//-------------------------------------------------------------------
+cpu_isa detect_cpu_isa() noexcept
+{
+#ifdef MC_CPU_DISPATCH_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("bmi2") && __builtin_cpu_supports("avx512bw")) {
+        return cpu_isa::avx512;
+    }
+#endif
+    return cpu_isa::baseline;
+}
+
+const cpu_isa hostIsa = detect_cpu_isa();
+
+cpu_isa activeIsa = cpu_isa::baseline;
+
+const bool kernelsSelected = [] {
+    activeIsa = hostIsa;
+    detail::encode_2bit_block_kernel = encode_2bit_block_variant(activeIsa);
+    return true;
+}();
+
+} // namespace
+
+
+
+//-------------------------------------------------------------------
+cpu_isa host_cpu_isa() noexcept
+{
+    return hostIsa;
+}
+
+
+//-------------------------------------------------------------------
+cpu_isa active_cpu_isa() noexcept
+{
+    return activeIsa;
+}
+
+
+//-------------------------------------------------------------------
+std::string to_string(cpu_isa isa)
+{
+    switch(isa) {
+        default:
+        case cpu_isa::baseline:
+#ifdef __SSE2__
+            return "baseline (SSE2)";
+#else
+            return "baseline";
+#endif
+        case cpu_isa::avx512: return "AVX-512";
+    }
+}
+
+
+//-------------------------------------------------------------------
+encode_2bit_block_function encode_2bit_block_variant(cpu_isa isa)
+{
+    switch(isa) {
+        default:
+        case cpu_isa::baseline: return &encode_2bit_block_baseline;
+#ifdef MC_CPU_DISPATCH_X86
+        case cpu_isa::avx512:   return &encode_2bit_block_avx512;
+#endif
+    }
+}
+
+
+} // namespace mc
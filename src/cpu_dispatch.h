@@ -0,0 +1,86 @@
+/******************************************************************************
+ *
+ * MetaCache - Meta-Genomic Classification Tool
+ *
+ * Copyright (C) 2016-2020 André Müller (muellan@uni-mainz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef MC_CPU_DISPATCH_H_
+#define MC_CPU_DISPATCH_H_
+
+#include <cstdint>
+#include <string>
+
+
+namespace mc {
+
+
+/*************************************************************************//**
+ *
+ * @brief instruction set variants of vectorized kernels
+ *        baseline: SSE2 (x86-64) or portable scalar code
+ *        avx512:   AVX-512BW + BMI2
+ *
+ *****************************************************************************/
+enum class cpu_isa : std::uint8_t {
+    baseline, avx512
+};
+
+
+/*************************************************************************//**
+ * @return best kernel variant that is supported by the host CPU
+ *         (only variants compiled into this executable are considered)
+ *****************************************************************************/
+cpu_isa host_cpu_isa() noexcept;
+
+/*************************************************************************//**
+ * @return kernel variant that was selected at program start
+ *****************************************************************************/
+cpu_isa active_cpu_isa() noexcept;
+
+//-------------------------------------------------------------------
+std::string to_string(cpu_isa);
+
+
+
+/*************************************************************************//**
+ *
+ * @brief encodes up to 64 nucleotides; see 'encode_2bit_block'
+ *
+ *****************************************************************************/
+using encode_2bit_block_function =
+    void(*)(const char*, int, std::uint64_t(&)[2], std::uint64_t&);
+
+/*************************************************************************//**
+ * @return encoder for a specific variant;
+ *         must only be called with variants supported by the host CPU
+ *****************************************************************************/
+encode_2bit_block_function encode_2bit_block_variant(cpu_isa);
+
+
+namespace detail {
+
+/// @brief encoder selected at program start
+extern encode_2bit_block_function encode_2bit_block_kernel;
+
+} // namespace detail
+
+
+} // namespace mc
+
+
+#endif
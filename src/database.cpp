@@ -20,6 +20,8 @@
  *
  *****************************************************************************/
 
+#include <cstdio>
+
 #include "database.h"
 
 
@@ -31,9 +33,6 @@ bool database::add_target(const sequence& seq, taxon_name sid,
                           taxon_id parentTaxid,
                           file_source source)
 {
-    using std::begin;
-    using std::end;
-
     //reached hard limit for number of targets
     if(targets_.size() >= max_target_count()) {
         throw target_limit_exceeded_error{};
@@ -44,11 +43,44 @@ bool database::add_target(const sequence& seq, taxon_name sid,
     //don't allow non-unique sequence ids
     if(name2tax_.find(sid) != name2tax_.end()) return false;
 
-    const auto targetCount = target_id(targets_.size());
-    const auto taxid = taxon_id_of_target(targetCount);
-
     //sketch sequence -> insert features
-    source.windows = add_all_window_sketches(seq, targetCount);
+    source.windows = add_all_window_sketches(seq, target_id(targets_.size()));
+
+    add_target_taxon(std::move(sid), parentTaxid, std::move(source));
+    return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+bool database::add_target(std::vector<sketch>&& windowSketches,
+                          taxon_name sid,
+                          taxon_id parentTaxid,
+                          file_source source)
+{
+    //reached hard limit for number of targets
+    if(targets_.size() >= max_target_count()) {
+        throw target_limit_exceeded_error{};
+    }
+
+    //don't allow non-unique sequence ids
+    if(name2tax_.find(sid) != name2tax_.end()) return false;
+
+    //insert features
+    source.windows = add_window_sketches(std::move(windowSketches),
+                                         target_id(targets_.size()));
+
+    add_target_taxon(std::move(sid), parentTaxid, std::move(source));
+    return true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::add_target_taxon(taxon_name sid, taxon_id parentTaxid,
+                                file_source source)
+{
+    const auto taxid = taxon_id_of_target(target_id(targets_.size()));
 
     //insert sequence metadata as a new taxon
     if(parentTaxid < 1) parentTaxid = 0;
@@ -69,14 +101,13 @@ bool database::add_target(const sequence& seq, taxon_name sid,
     targets_.push_back(newtax);
 
     targetLineages_.mark_outdated();
-
-    return true;
 }
 
 
 
 // ----------------------------------------------------------------------------
-void database::read(const std::string& filename, scope what)
+void database::read(const std::string& filename, scope what,
+                    unsigned concurrency)
 
 {
     std::ifstream is{filename, std::ios::in | std::ios::binary};
@@ -91,7 +122,7 @@ void database::read(const std::string& filename, scope what)
     uint64_t dbVer = 0;
     read_binary(is, dbVer);
 
-    if(uint64_t( MC_DB_VERSION ) != dbVer) {
+    if(dbVer < uint64_t( MC_DB_VERSION_MIN ) || dbVer > uint64_t( MC_DB_VERSION )) {
         throw file_read_error{
             "Database " + filename + " (version " + std::to_string(dbVer) + ")"
             + " is incompatible\nwith this version of MetaCache"
@@ -131,6 +162,59 @@ void database::read(const std::string& filename, scope what)
 
     clear();
 
+    //hash table format; older versions only used compact, unfinalized
+    //tables with plain location lists and the same-size hash function
+    layout_ = file_layout::compact;
+    encoding_ = location_encoding::plain;
+    finalized_ = false;
+    int_hash featureHash = int_hash::same_size;
+    bool sameSlots = true;
+    if(dbVer >= uint64_t( MC_DB_VERSION_TABLE_FORMAT )) {
+        uint8_t layout = 0;
+        read_binary(is, layout);
+        if(layout > uint8_t(file_layout::mappable)) {
+            throw file_read_error{
+                "Database " + filename + " uses an unknown file layout"};
+        }
+        layout_ = file_layout(layout);
+
+        uint8_t encoding = 0;
+        read_binary(is, encoding);
+        if(encoding > uint8_t(location_encoding::packed)) {
+            throw file_read_error{
+                "Database " + filename + " uses an unknown location encoding"};
+        }
+        encoding_ = location_encoding(encoding);
+
+        uint8_t finalized = 0;
+        read_binary(is, finalized);
+        finalized_ = (finalized != 0);
+
+        uint8_t hash = 0;
+        read_binary(is, hash);
+        if(hash > uint8_t(last_int_hash())) {
+            throw file_read_error{
+                "Database " + filename + " uses an unknown feature hash function"};
+        }
+        featureHash = int_hash(hash);
+
+        //hash table geometry; slots of the mappable layout depend on it,
+        //the bucket section doesn't depend on the bucket variant
+        uint8_t probing = 0;
+        read_binary(is, probing);
+        uint8_t binSize = 0;
+        read_binary(is, binSize);
+        uint8_t compactBuckets = 0;
+        read_binary(is, compactBuckets);
+        if(probing > uint8_t(probing_kind::cuckoo) || binSize < 1) {
+            throw file_read_error{
+                "Database " + filename + " uses an unknown probing scheme"};
+        }
+        sameSlots = (probing == uint8_t(feature_store::probing())) &&
+                    (binSize == feature_store::probing_bin_size());
+    }
+    feature_hash_function(featureHash);
+
     //sketching parameters
     read_binary(is, targetSketcher_);
     read_binary(is, querySketcher_);
@@ -165,7 +249,30 @@ void database::read(const std::string& filename, scope what)
     if(what == scope::metadata_only) return;
 
     //hash table
-    read_binary(is, features_);
+    if(finalized_) {
+        if(encoding_ == location_encoding::packed) {
+            read_binary(is, staticPackedFeatures_);
+        } else {
+            read_binary(is, staticFeatures_);
+        }
+    }
+    else if(encoding_ == location_encoding::packed) {
+        if(layout_ == file_layout::mappable) {
+            read_binary_layout(is, packedFeatures_, filename);
+            //keys are not where this variant's probing scheme looks
+            if(!sameSlots) {
+                packedFeatures_.rehash(packedFeatures_.bucket_count() + 1);
+            }
+        } else {
+            read_binary(is, packedFeatures_, concurrency);
+        }
+    }
+    else if(layout_ == file_layout::mappable) {
+        read_binary_layout(is, features_, filename);
+        if(!sameSlots) features_.rehash(features_.bucket_count() + 1);
+    } else {
+        read_binary(is, features_, concurrency);
+    }
 }
 
 
@@ -176,10 +283,14 @@ void database::write(const std::string& filename) const
     using std::uint64_t;
     using std::uint8_t;
 
-    std::ofstream os{filename, std::ios::out | std::ios::binary};
+    //write to temporary file first, because the database file might
+    //still be memory-mapped (e.g. when modifying a mappable database)
+    const auto tmpfilename = filename + ".tmp";
+
+    std::ofstream os{tmpfilename, std::ios::out | std::ios::binary};
 
     if(!os.good()) {
-        throw file_access_error{"can't open file " + filename};
+        throw file_access_error{"can't open file " + tmpfilename};
     }
 
     //database version info
@@ -193,6 +304,15 @@ void database::write(const std::string& filename) const
     write_binary(os, uint8_t(sizeof(taxon_id)));
     write_binary(os, uint8_t(taxonomy::num_ranks));
 
+    //feature store layout
+    write_binary(os, uint8_t(layout_));
+    write_binary(os, uint8_t(encoding_));
+    write_binary(os, uint8_t(finalized_));
+    write_binary(os, uint8_t(feature_hash_function()));
+    write_binary(os, uint8_t(feature_store::probing()));
+    write_binary(os, uint8_t(feature_store::probing_bin_size()));
+    write_binary(os, uint8_t(feature_store::compact_buckets()));
+
     //sketching parameters
     write_binary(os, targetSketcher_);
     write_binary(os, querySketcher_);
@@ -205,50 +325,384 @@ void database::write(const std::string& filename) const
     write_binary(os, target_id(targets_.size()));
 
     //hash table
-    write_binary(os, features_);
+    if(finalized_) {
+        if(encoding_ == location_encoding::packed) {
+            write_binary(os, staticPackedFeatures_);
+        } else {
+            write_binary(os, staticFeatures_);
+        }
+    }
+    else if(encoding_ == location_encoding::packed) {
+        if(layout_ == file_layout::mappable) {
+            write_binary_layout(os, packedFeatures_);
+        } else {
+            write_binary(os, packedFeatures_);
+        }
+    }
+    else if(layout_ == file_layout::mappable) {
+        write_binary_layout(os, features_);
+    } else {
+        write_binary(os, features_);
+    }
+
+    os.close();
+    if(!os || std::rename(tmpfilename.c_str(), filename.c_str()) != 0) {
+        std::remove(tmpfilename.c_str());
+        throw file_access_error{"can't write file " + filename};
+    }
 }
 
 
 
 // ----------------------------------------------------------------------------
-void database::max_locations_per_feature(bucket_size_type n)
+void database::max_locations_per_feature(bucket_size_type n,
+                                         unsigned concurrency)
 {
     if(n < 1) n = 1;
     if(n >= max_supported_locations_per_feature()) {
         n = max_supported_locations_per_feature();
     }
     else if(n < maxLocsPerFeature_) {
-        for(auto i = features_.begin(), e = features_.end(); i != e; ++i) {
-            if(i->size() > n) features_.shrink(i, n);
-        }
+        with_feature_store([&] (auto& store) {
+            using iterator = typename std::decay_t<decltype(store)>::iterator;
+            using shrinking = std::pair<iterator,std::size_t>;
+
+            std::vector<std::vector<shrinking>> shrunk(std::max(1u, concurrency));
+
+            //(packed) lists are re-encoded in place
+            for_each_bucket_range(store, concurrency,
+                [&] (unsigned part, iterator i, iterator e) {
+                    match_locations locs;
+                    std::vector<std::uint8_t> bytes;
+                    for(; i != e; ++i) {
+                        const auto size = shrunk_location_list(
+                            i, n, i->begin(), locs, bytes);
+                        if(size < i->size()) shrunk[part].emplace_back(i, size);
+                    }
+                });
+
+            //changes table state => single-threaded
+            for(const auto& part : shrunk) {
+                for(const auto& x : part) store.shrink(x.first, x.second);
+            }
+        });
     }
     maxLocsPerFeature_ = n;
 }
 
 
 
+// ----------------------------------------------------------------------------
+void database::encoding(location_encoding enc)
+{
+    if(enc == encoding_) return;
+
+    if(finalized_) {
+        unfinalize();
+        encoding(enc);
+        finalize();
+        return;
+    }
+
+    wait_until_add_target_complete();
+
+    if(enc == location_encoding::packed) {
+        std::vector<std::uint8_t> bytes;
+        match_locations sorted;
+        const auto pack = [&] (const feature_store::bucket_type& b) {
+            bytes.clear();
+            if(std::is_sorted(b.begin(), b.end())) {
+                pack_locations(b.begin(), b.end(), bytes);
+            } else {
+                sorted.assign(b.begin(), b.end());
+                std::sort(sorted.begin(), sorted.end());
+                pack_locations(sorted.data(), sorted.data() + sorted.size(), bytes);
+            }
+        };
+        using packed_bucket = packed_feature_store::bucket_type;
+
+        //first pass: only lists that don't fit into buckets need memory
+        std::uint64_t numBytes = 0;
+        for(const auto& b : features_) {
+            if(b.size() > 0) {
+                pack(b);
+                if(bytes.size() > packed_bucket::inline_capacity()) {
+                    numBytes += bytes.size();
+                }
+            }
+        }
+        packedFeatures_.clear();
+        packedFeatures_.reserve_keys(features_.key_count());
+        packedFeatures_.reserve_values(numBytes);
+
+        for(const auto& b : features_) {
+            if(!b.unused()) {
+                pack(b);
+                packedFeatures_.insert(b.key(), bytes.begin(), bytes.end());
+            }
+        }
+        features_.clear();
+    }
+    else {
+        using plain_bucket = feature_store::bucket_type;
+
+        std::uint64_t numLocs = 0;
+        for(const auto& b : packedFeatures_) {
+            if(b.size() > 0) {
+                const auto n = packed_location_count(b.begin());
+                if(n > plain_bucket::inline_capacity()) numLocs += n;
+            }
+        }
+        features_.clear();
+        features_.reserve_keys(packedFeatures_.key_count());
+        features_.reserve_values(numLocs);
+
+        match_locations locs;
+        for(const auto& b : packedFeatures_) {
+            if(!b.unused()) {
+                locs.clear();
+                if(b.size() > 0) unpack_locations(b.begin(), locs);
+                features_.insert(b.key(), locs.begin(), locs.end());
+            }
+        }
+        packedFeatures_.clear();
+    }
+    encoding_ = enc;
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::finalize()
+{
+    if(finalized_) return;
+
+    wait_until_add_target_complete();
+
+    if(encoding_ == location_encoding::packed) {
+        staticPackedFeatures_.assign(packedFeatures_.begin(),
+                                     packedFeatures_.end());
+        packedFeatures_.clear();
+    } else {
+        staticFeatures_.assign(features_.begin(), features_.end());
+        features_.clear();
+    }
+    finalized_ = true;
+}
+
+
+
+// ----------------------------------------------------------------------------
+template<class StaticStore, class HashStore>
+void rebuild_hash_table(StaticStore& source, HashStore& target)
+{
+    using bucket_t = typename HashStore::bucket_type;
+
+    //values of small lists are stored in the buckets themselves
+    std::uint64_t numValues = 0;
+    for(const auto& b : source) {
+        if(b.size() > bucket_t::inline_capacity()) numValues += b.size();
+    }
+    target.clear();
+    target.reserve_keys(source.key_count());
+    target.reserve_values(numValues);
+
+    for(const auto& b : source) {
+        target.insert(b.key(), b.begin(), b.end());
+    }
+    source.clear();
+}
+
+//-------------------------------------------------------------------
+void database::unfinalize()
+{
+    if(!finalized_) return;
+
+    if(encoding_ == location_encoding::packed) {
+        rebuild_hash_table(staticPackedFeatures_, packedFeatures_);
+    } else {
+        rebuild_hash_table(staticFeatures_, features_);
+    }
+    finalized_ = false;
+}
+
+
+
 // ----------------------------------------------------------------------------
 database::feature_count_type
-database::remove_features_with_more_locations_than(bucket_size_type n)
+database::remove_features_with_more_locations_than(bucket_size_type n,
+                                                   unsigned concurrency)
 {
-    //note that features are not really removed, because the hashmap
-    //does not support erasing keys; instead all values belonging to
-    //the key are cleared and the key is kept without values
-    feature_count_type rem = 0;
-    for(auto i = features_.begin(), e = features_.end(); i != e; ++i) {
-        if(i->size() > n) {
-            features_.clear(i);
-            ++rem;
+    return erase_features_if(
+        [n] (const location* first, const location* last) {
+            return (last - first) > n;
+        },
+        concurrency);
+}
+
+
+
+// ----------------------------------------------------------------------------
+unsigned database::replicate_per_numa_node()
+{
+    replicas_.clear();
+    //the original store stays where it is and serves the first node
+    replicaNodes_ = usable_numa_nodes();
+
+    const auto policy = current_memory_policy();
+
+    for(std::size_t i = 1; i < replicaNodes_.size(); ++i) {
+        //all copies share the process-wide value handles
+        if(!feature_store_copyable()) {
+            replicaNodes_.resize(i);
+            break;
         }
+        const auto node = replicaNodes_[i];
+        //pages that are not placed by the memory policy
+        //(small arrays) are placed by first touch
+        numa_node_binding binding{node};
+
+        auto local = policy;
+        local.numa = numa_policy::node;
+        local.node = std::uint16_t(node);
+        set_memory_policy(local);
+
+        auto replica = std::make_unique<feature_store_replica>();
+        with_feature_store([&] (const auto& store) {
+            using store_t = std::decay_t<decltype(store)>;
+            std::get<store_t>(*replica) = store_t{store};
+        });
+        replicas_.push_back(std::move(replica));
     }
-    return rem;
+
+    set_memory_policy(policy);
+    return replica_count();
+}
+
+
+
+// ----------------------------------------------------------------------------
+bool database::compact()
+{
+    //perfect hash index is always compact
+    if(finalized_) return true;
+
+    if(encoding_ == location_encoding::packed) {
+        return packedFeatures_.compact();
+    }
+    return features_.compact();
+}
+
+
+
+// ----------------------------------------------------------------------------
+bool database::feature_store_copyable() const
+{
+    //perfect hash index doesn't use value handles
+    if(finalized_) return true;
+
+    if(encoding_ == location_encoding::packed) {
+        return packedFeatures_.values_copyable();
+    }
+    return features_.values_copyable();
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::count_target_locations(const std::vector<sketch>& windowSketches)
+{
+    for(const auto& sk : windowSketches) {
+        countedFeatures_.insert(countedFeatures_.end(), sk.begin(), sk.end());
+    }
+
+    //merging needs a copy of all counts => amortize over many occurrences
+    const auto minMergeSize = std::max(std::size_t(1) << 24,
+                                       locationCounts_.size());
+
+    if(countedFeatures_.size() >= minMergeSize) merge_counted_features();
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::merge_counted_features()
+{
+    std::sort(countedFeatures_.begin(), countedFeatures_.end());
+
+    //lists can briefly exceed the maximum before they are shrunk
+    const std::uint64_t maxCount = maxLocsPerFeature_ + 1;
+
+    std::vector<std::pair<feature,bucket_size_type>> merged;
+    merged.reserve(locationCounts_.size() + countedFeatures_.size() / 2);
+
+    auto c = locationCounts_.begin();
+    for(auto f = countedFeatures_.begin(); f != countedFeatures_.end(); ) {
+        const auto key = *f;
+        std::uint64_t n = 0;
+        for(; f != countedFeatures_.end() && *f == key; ++f) ++n;
+
+        for(; c != locationCounts_.end() && c->first < key; ++c) {
+            merged.push_back(*c);
+        }
+        if(c != locationCounts_.end() && c->first == key) {
+            n += c->second;
+            ++c;
+        }
+        merged.emplace_back(key, bucket_size_type(std::min(n, maxCount)));
+    }
+    merged.insert(merged.end(), c, locationCounts_.end());
+
+    locationCounts_.swap(merged);
+    countedFeatures_.clear();
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::reserve_counted_locations()
+{
+    merge_counted_features();
+
+    //insertion batches must not trigger a rehash
+    const auto batchKeys = std::uint64_t(1000) * insertionConcurrency_ *
+                           targetSketcher_.sketch_size();
+
+    features_.reserve_exactly(locationCounts_, batchKeys);
+
+    decltype(countedFeatures_){}.swap(countedFeatures_);
+    decltype(locationCounts_){}.swap(locationCounts_);
+}
+
+
+
+// ----------------------------------------------------------------------------
+void database::reserve_features(feature_count_type n)
+{
+    features_.reserve_keys(features_.key_count() + n);
+}
+
+
+
+// ----------------------------------------------------------------------------
+std::uint64_t
+database::predicted_feature_memory(feature_count_type numFeatures,
+                                   std::uint64_t numLocations) const noexcept
+{
+    const auto numBuckets = std::uint64_t(1 + numFeatures / max_load_factor());
+
+    //ignores that single locations are stored inside buckets
+    //and that growing lists have some spare capacity
+    return numBuckets * sizeof(feature_store::bucket_type) +
+           numLocations * sizeof(location);
 }
 
 
 
 // ----------------------------------------------------------------------------
 database::feature_count_type
-database::remove_ambiguous_features(taxon_rank r, bucket_size_type maxambig)
+database::remove_ambiguous_features(taxon_rank r, bucket_size_type maxambig,
+                                    unsigned concurrency)
 {
     feature_count_type rem = 0;
 
@@ -258,35 +712,43 @@ database::remove_ambiguous_features(taxon_rank r, bucket_size_type maxambig)
 
     if(maxambig == 0) maxambig = 1;
 
+    //taxa might have been changed after targets were added
+    update_cached_lineages(taxon_rank::Sequence);
+
+    //distinct values seen so far; has at most 'maxambig' elements,
+    //so a linear search is cheaper than a tree or hash set
+    const auto exceeds = [maxambig] (auto& seen, const auto& x) {
+        if(std::find(seen.begin(), seen.end(), x) != seen.end()) return false;
+        if(seen.size() >= maxambig) return true;
+        seen.push_back(x);
+        return false;
+    };
+
     if(r == taxon_rank::Sequence) {
-        for(auto i = features_.begin(), e = features_.end(); i != e; ++i) {
-            if(!i->empty()) {
-                std::set<target_id> targets;
-                for(auto loc : *i) {
-                    targets.insert(loc.tgt);
-                    if(targets.size() > maxambig) {
-                        features_.clear(i);
-                        ++rem;
-                        break;
-                    }
+        rem = erase_features_if(
+            [&, targets = std::vector<target_id>{}]
+            (const location* first, const location* last) mutable {
+                targets.clear();
+                for(; first != last; ++first) {
+                    if(exceeds(targets, first->tgt)) return true;
                 }
-            }
-        }
+                return false;
+            },
+            concurrency);
     }
     else {
-        for(auto i = features_.begin(), e = features_.end(); i != e; ++i) {
-            if(!i->empty()) {
-                std::set<const taxon*> taxa;
-                for(auto loc : *i) {
-                    taxa.insert(targetLineages_[loc.tgt][int(r)]);
-                    if(taxa.size() > maxambig) {
-                        features_.clear(i);
-                        ++rem;
-                        break;
+        rem = erase_features_if(
+            [&, taxa = std::vector<const taxon*>{}]
+            (const location* first, const location* last) mutable {
+                taxa.clear();
+                for(; first != last; ++first) {
+                    if(exceeds(taxa, targetLineages_[first->tgt][int(r)])) {
+                        return true;
                     }
                 }
-            }
-        }
+                return false;
+            },
+            concurrency);
     }
     return rem;
 }
@@ -298,7 +760,14 @@ void database::clear() {
     ranksCache_.clear();
     targetLineages_.clear();
     name2tax_.clear();
+    replicas_.clear();
+    replicaNodes_.clear();
     features_.clear();
+    packedFeatures_.clear();
+    staticFeatures_.clear();
+    staticPackedFeatures_.clear();
+    countedFeatures_.clear();
+    locationCounts_.clear();
 }
 
 
@@ -311,6 +780,7 @@ void database::clear_without_deallocation() {
     targetLineages_.clear();
     name2tax_.clear();
     features_.clear_without_deallocation();
+    packedFeatures_.clear_without_deallocation();
 }
 
 
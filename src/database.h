@@ -39,6 +39,8 @@
 #include <memory>
 #include <future>
 #include <chrono>
+#include <tuple>
+#include <iterator>
 
 #include "version.h"
 #include "config.h"
@@ -47,6 +49,8 @@
 #include "stat_combined.h"
 #include "taxonomy.h"
 #include "hash_multimap.h"
+#include "perfect_hash_multimap.h"
+#include "memory_policy.h"
 #include "dna_encoding.h"
 #include "typename.h"
 
@@ -106,6 +110,7 @@ public:
     using sequence         = mc::sequence;
     using sketcher         = mc::sketcher;
     using feature_hash     = mc::feature_hash;
+    using feature_probing  = mc::feature_probing;
     using target_id        = mc::target_id;
     using window_id        = mc::window_id;
     using bucket_size_type = mc::loclist_size_t;
@@ -127,6 +132,26 @@ public:
     //---------------------------------------------------------------
     enum class scope { everything, metadata_only };
 
+    //---------------------------------------------------------------
+    /**
+     * @brief on-disk representation of the feature store
+     *        compact:  only non-empty buckets; hash table is rebuilt on load
+     *        mappable: bucket layout is preserved; the bucket table is read
+     *                  without rehashing, large location lists are
+     *                  memory-mapped where possible
+     */
+    enum class file_layout : std::uint8_t { compact, mappable };
+
+    //---------------------------------------------------------------
+    /**
+     * @brief in-memory (and on-disk) representation of location lists
+     *        plain:  arrays of (window, target) pairs
+     *        packed: delta + varint encoded byte sequences; about half
+     *                the size, but lists have to be decoded on lookup
+     *                and can't be extended by adding targets
+     */
+    enum class location_encoding : std::uint8_t { plain, packed };
+
 
     //-----------------------------------------------------
     class target_limit_exceeded_error : public std::runtime_error {
@@ -183,9 +208,30 @@ private:
     using feature_store = hash_multimap<feature,location, //key, value
                               feature_hash,               //key hasher
                               std::equal_to<feature>,     //key comparator
-                              chunk_allocator<location>,  //value allocator
-                              std::allocator<feature>,    //bucket+key allocator
-                              bucket_size_type>;          //location list size
+                              feature_value_allocator<location>, //value allocator
+                              page_allocator<feature>,    //bucket+key allocator
+                              bucket_size_type,           //location list size
+                              feature_probing>;           //collision resolution
+
+    /// @brief a packed list needs up to 8 bytes per location
+    using packed_size_type = std::conditional_t<(sizeof(bucket_size_type) < 2),
+                                                std::uint16_t, std::uint32_t>;
+
+    /// @brief maps features to packed location lists (byte sequences)
+    using packed_feature_store = hash_multimap<feature,std::uint8_t,
+                              feature_hash,
+                              std::equal_to<feature>,
+                              feature_value_allocator<std::uint8_t>,
+                              page_allocator<feature>,
+                              packed_size_type,
+                              feature_probing>;
+
+    /// @brief read-only feature stores of finalized databases
+    using static_feature_store = perfect_hash_multimap<
+                              feature,location,bucket_size_type>;
+
+    using static_packed_feature_store = perfect_hash_multimap<
+                              feature,std::uint8_t,packed_size_type>;
 
 
     //-----------------------------------------------------
@@ -204,6 +250,65 @@ private:
 
     using sketch_batch = std::vector<window_sketch>;
 
+    //-----------------------------------------------------
+    /// @brief only the store type currently in use is filled
+    using feature_store_replica = std::tuple<
+        feature_store, packed_feature_store,
+        static_feature_store, static_packed_feature_store>;
+
+
+    //---------------------------------------------------------------
+    /// @brief calls 'f(store)' with the feature store currently in use
+    template<class F>
+    decltype(auto) with_feature_store(F&& f) const
+    {
+        if(finalized_) {
+            if(encoding_ == location_encoding::packed) {
+                return f(staticPackedFeatures_);
+            }
+            return f(staticFeatures_);
+        }
+        if(encoding_ == location_encoding::packed) {
+            return f(packedFeatures_);
+        }
+        return f(features_);
+    }
+    //-----------------------------------------------------
+    template<class F>
+    decltype(auto) with_feature_store(F&& f)
+    {
+        if(finalized_) {
+            if(encoding_ == location_encoding::packed) {
+                return f(staticPackedFeatures_);
+            }
+            return f(staticFeatures_);
+        }
+        if(encoding_ == location_encoding::packed) {
+            return f(packedFeatures_);
+        }
+        return f(features_);
+    }
+    //-----------------------------------------------------
+    /// @brief calls 'f(store)' with a replica of the store currently in use
+    template<class F>
+    decltype(auto) with_feature_store(unsigned replica, F&& f) const
+    {
+        if(replica < 1 || replica > replicas_.size()) {
+            return with_feature_store(std::forward<F>(f));
+        }
+        const auto& r = *replicas_[replica-1];
+        if(finalized_) {
+            if(encoding_ == location_encoding::packed) {
+                return f(std::get<static_packed_feature_store>(r));
+            }
+            return f(std::get<static_feature_store>(r));
+        }
+        if(encoding_ == location_encoding::packed) {
+            return f(std::get<packed_feature_store>(r));
+        }
+        return f(std::get<feature_store>(r));
+    }
+
 
 public:
     //---------------------------------------------------------------
@@ -262,6 +367,7 @@ public:
         match_locations locs_; // match locations from hashmap
         std::vector<std::size_t> offsets_;  // bucket sizes for merge sort
         match_locations temp_; // temp buffer for merge sort
+        sketch sketch_; // reused query sketch storage
     };
 
 
@@ -276,15 +382,29 @@ public:
         targetSketcher_{std::move(targetSketcher)},
         querySketcher_{std::move(querySketcher)},
         maxLocsPerFeature_(max_supported_locations_per_feature()),
+        layout_{file_layout::compact},
+        encoding_{location_encoding::plain},
+        finalized_{false},
+        memoryPolicy_{},
+        insertionConcurrency_{1},
+        incrementalRehash_{false},
         features_{},
+        packedFeatures_{},
+        staticFeatures_{},
+        staticPackedFeatures_{},
         targets_{},
         taxa_{},
         ranksCache_{taxa_, taxon_rank::Sequence},
         targetLineages_{taxa_},
         name2tax_{},
+        replicas_{},
+        replicaNodes_{},
+        countedFeatures_{},
+        locationCounts_{},
         inserter_{}
     {
         features_.max_load_factor(default_max_load_factor());
+        packedFeatures_.max_load_factor(default_max_load_factor());
     }
 
     database(const database&) = delete;
@@ -292,12 +412,25 @@ public:
         targetSketcher_{std::move(other.targetSketcher_)},
         querySketcher_{std::move(other.querySketcher_)},
         maxLocsPerFeature_(other.maxLocsPerFeature_),
+        layout_{other.layout_},
+        encoding_{other.encoding_},
+        finalized_{other.finalized_},
+        memoryPolicy_{other.memoryPolicy_},
+        insertionConcurrency_{other.insertionConcurrency_},
+        incrementalRehash_{other.incrementalRehash_},
         features_{std::move(other.features_)},
+        packedFeatures_{std::move(other.packedFeatures_)},
+        staticFeatures_{std::move(other.staticFeatures_)},
+        staticPackedFeatures_{std::move(other.staticPackedFeatures_)},
         targets_{std::move(other.targets_)},
         taxa_{std::move(other.taxa_)},
         ranksCache_{std::move(other.ranksCache_)},
         targetLineages_{std::move(other.targetLineages_)},
         name2tax_{std::move(other.name2tax_)},
+        replicas_{std::move(other.replicas_)},
+        replicaNodes_{std::move(other.replicaNodes_)},
+        countedFeatures_{std::move(other.countedFeatures_)},
+        locationCounts_{std::move(other.locationCounts_)},
         inserter_{std::move(other.inserter_)}
     {}
 
@@ -341,7 +474,11 @@ public:
 
 
     //---------------------------------------------------------------
-    void max_locations_per_feature(bucket_size_type);
+    /**
+     * @brief sets the location list size limit; longer lists are shrunk
+     *        by up to 'concurrency' threads
+     */
+    void max_locations_per_feature(bucket_size_type, unsigned concurrency = 1);
 
     //-----------------------------------------------------
     bucket_size_type
@@ -356,19 +493,31 @@ public:
 
     //-----------------------------------------------------
     feature_count_type
-    remove_features_with_more_locations_than(bucket_size_type);
+    remove_features_with_more_locations_than(bucket_size_type,
+                                             unsigned concurrency = 1);
+
+    //-----------------------------------------------------
+    /**
+     * @brief  rebuilds the feature hash table without the slots
+     *         of removed features and gives back unused memory
+     * @return false, if there were not enough value handles left
+     *         for the rebuilt table (compact buckets)
+     */
+    bool compact();
 
 
     //---------------------------------------------------------------
     /**
      * @brief  removes features that have more than 'maxambig' different
      *         taxa on a certain taxonomic rank
-     *         e.g. remove features that are present in more than 4 phyla
+     *         e.g. remove features that are present in more than 4 phyla;
+     *         location lists are examined by up to 'concurrency' threads
      *
      * @return number of features (hash table buckets) that were removed
      */
     feature_count_type
-    remove_ambiguous_features(taxon_rank, bucket_size_type maxambig);
+    remove_ambiguous_features(taxon_rank, bucket_size_type maxambig,
+                              unsigned concurrency = 1);
 
 
     //---------------------------------------------------------------
@@ -376,6 +525,62 @@ public:
                     taxon_id parentTaxid = 0,
                     file_source source = file_source{});
 
+    //-----------------------------------------------------
+    /**
+     * @brief adds target with sketches of all its windows
+     *        that were obtained with 'target_sketches'
+     */
+    bool add_target(std::vector<sketch>&& windowSketches, taxon_name sid,
+                    taxon_id parentTaxid = 0,
+                    file_source source = file_source{});
+
+    //-----------------------------------------------------
+    /**
+     * @brief sketches all windows of a target sequence;
+     *        doesn't modify the database, so sequences can be sketched
+     *        concurrently and then be added in a deterministic order
+     */
+    std::vector<sketch>
+    target_sketches(const sequence& seq) const {
+        std::vector<sketch> sketches;
+        targetSketcher_.for_each_sketch(seq, [&] (auto&& sk) {
+            sketches.push_back(std::move(sk));
+        });
+        return sketches;
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief first pass of a two-pass build:
+     *        counts the locations of each feature in a target's sketches
+     *        without adding the target
+     */
+    void count_target_locations(const std::vector<sketch>& windowSketches);
+
+    //-----------------------------------------------------
+    /**
+     * @brief pre-allocates all location lists counted so far with their
+     *        exact size in one contiguous block of memory;
+     *        targets added afterwards fill them without reallocation
+     */
+    void reserve_counted_locations();
+
+    //-----------------------------------------------------
+    /**
+     * @brief sizes the feature table for 'n' more features,
+     *        so that it doesn't have to grow while targets are added
+     */
+    void reserve_features(feature_count_type n);
+
+    //-----------------------------------------------------
+    /**
+     * @brief predicted memory usage (in bytes) of a feature table
+     *        with the given number of features and locations
+     */
+    std::uint64_t
+    predicted_feature_memory(feature_count_type numFeatures,
+                             std::uint64_t numLocations) const noexcept;
+
 
 
     //---------------------------------------------------------------
@@ -394,7 +599,9 @@ public:
 
     //-----------------------------------------------------
     bool empty() const noexcept {
-        return features_.empty();
+        return with_feature_store([] (const auto& store) {
+            return store.empty();
+        });
     }
 
 
@@ -638,54 +845,165 @@ public:
     template<class InputIterator>
     void
     accumulate_matches(InputIterator queryBegin, InputIterator queryEnd,
-                       matches_sorter& res) const
+                       matches_sorter& res, unsigned replica = 0) const
     {
-        querySketcher_.for_each_sketch(queryBegin, queryEnd,
-            [this, &res] (const auto& sk) {
-                 res.offsets_.reserve(res.offsets_.size() + sk.size());
-
-                for(auto f : sk) {
-                    auto locs = features_.find(f);
-                    if(locs != features_.end() && locs->size() > 0) {
-                        res.locs_.insert(res.locs_.end(), locs->begin(), locs->end());
-                        res.offsets_.emplace_back(res.locs_.size());
-                    }
-                }
-            });
+        with_feature_store(replica, [&] (const auto& store) {
+            querySketcher_.for_each_sketch(queryBegin, queryEnd, res.sketch_,
+                [&] (const auto& sk) {
+                    res.offsets_.reserve(res.offsets_.size() + sk.size());
+
+                    //overlaps memory accesses of all lookups of a sketch
+                    store.find_batch(sk.begin(), sk.end(),
+                        [&] (const feature&, auto locs) {
+                            if(locs != store.end() && locs->size() > 0) {
+                                append_locations(locs->begin(), locs->end(), res.locs_);
+                                res.offsets_.emplace_back(res.locs_.size());
+                            }
+                        });
+                });
+        });
     }
 
     //---------------------------------------------------------------
     void
     accumulate_matches(const sequence& query,
-                       matches_sorter& res) const
+                       matches_sorter& res, unsigned replica = 0) const
     {
         using std::begin;
         using std::end;
-        accumulate_matches(begin(query), end(query), res);
+        accumulate_matches(begin(query), end(query), res, replica);
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief  copies the feature store for each usable NUMA node except
+     *         the first one (see 'usable_numa_nodes');
+     *         each copy is allocated in (and first touched from) its node;
+     *         stops early if there are not enough value handles left
+     *         (compact buckets); must be called after all modifications
+     *         of the database
+     * @return number of stores including the original (1 per node)
+     */
+    unsigned replicate_per_numa_node();
+    //-----------------------------------------------------
+    /// @brief number of feature stores
+    unsigned replica_count() const noexcept {
+        return unsigned(1 + replicas_.size());
+    }
+    //-----------------------------------------------------
+    /// @brief replica i is placed on NUMA node replica_nodes()[i];
+    ///        empty if the store is not replicated
+    const std::vector<unsigned>& replica_nodes() const noexcept {
+        return replicaNodes_;
     }
 
 
     //---------------------------------------------------------------
     void max_load_factor(float lf) {
         features_.max_load_factor(lf);
+        packedFeatures_.max_load_factor(lf);
     }
     //-----------------------------------------------------
     float max_load_factor() const noexcept {
         return features_.max_load_factor();
     }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief sets the hash function of the feature hash table and rehashes
+     *        all features; the function is stored in the database file
+     */
+    void feature_hash_function(int_hash h) {
+        features_.hash_function(feature_hash{h});
+        packedFeatures_.hash_function(feature_hash{h});
+    }
+    //-----------------------------------------------------
+    int_hash feature_hash_function() const noexcept {
+        return features_.hash_function().function();
+    }
     //-----------------------------------------------------
     static constexpr float default_max_load_factor() noexcept {
         return 0.8f;
     }
+    //-----------------------------------------------------
+    /**
+     * @brief reduces the number of hash table buckets to the minimum
+     *        allowed by the maximum load factor
+     */
+    void shrink_to_fit() {
+        if(finalized_) return;
+        if(encoding_ == location_encoding::packed) {
+            packedFeatures_.reserve_keys(packedFeatures_.key_count());
+        } else {
+            features_.reserve_keys(features_.key_count());
+        }
+    }
+
+    //---------------------------------------------------------------
+    /** @brief sets the on-disk representation used by 'write' */
+    void layout(file_layout l) noexcept {
+        layout_ = l;
+    }
+    //-----------------------------------------------------
+    file_layout layout() const noexcept {
+        return layout_;
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief re-encodes all location lists;
+     *        targets can only be added to plain location lists
+     */
+    void encoding(location_encoding);
+    //-----------------------------------------------------
+    location_encoding encoding() const noexcept {
+        return encoding_;
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief replaces the hash table with a read-only, minimal perfect
+     *        hash index that needs less memory and no probing on lookup;
+     *        features without locations are discarded
+     */
+    void finalize();
+    //-----------------------------------------------------
+    /** @brief rebuilds the (modifiable) hash table of a finalized database */
+    void unfinalize();
+    //-----------------------------------------------------
+    bool finalized() const noexcept {
+        return finalized_;
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief sets huge page & NUMA placement of tables allocated from now on;
+     *        the policy depends on the host and is not stored in the file
+     */
+    void memory(const memory_policy& policy) {
+        memoryPolicy_ = policy;
+        set_memory_policy(policy);
+    }
+    //-----------------------------------------------------
+    const memory_policy& memory() const noexcept {
+        return memoryPolicy_;
+    }
+
 
     /**
      * @brief   read database from binary file
-     * @details Note that the map is not just de-serialized but
-     *          rebuilt by inserting individual keys and values
+     * @details In the compact file layout the map is not just de-serialized
+     *          but rebuilt by inserting individual keys and values.
      *          This should make DB files more robust against changes in the
      *          internal mapping structure.
+     *          In the mappable layout the bucket array is read slot by slot
+     *          and large location lists are memory-mapped from the file.
+     *          The compact layout is rebuilt with up to 'concurrency'
+     *          insertion threads.
      */
-    void read(const std::string& filename, scope what = scope::everything);
+    void read(const std::string& filename, scope what = scope::everything,
+              unsigned concurrency = 1);
     /**
      * @brief   write database to binary file
      */
@@ -694,19 +1012,37 @@ public:
 
     //---------------------------------------------------------------
     std::uint64_t bucket_count() const noexcept {
-        return features_.bucket_count();
+        return with_feature_store([] (const auto& store) {
+            return std::uint64_t(store.bucket_count());
+        });
     }
     //---------------------------------------------------------------
     std::uint64_t feature_count() const noexcept {
-        return features_.key_count();
+        return with_feature_store([] (const auto& store) {
+            return std::uint64_t(store.key_count());
+        });
     }
     //---------------------------------------------------------------
     std::uint64_t dead_feature_count() const noexcept {
-        return features_.key_count() - features_.non_empty_bucket_count();
+        return with_feature_store([] (const auto& store) {
+            return std::uint64_t(store.key_count() -
+                                 store.non_empty_bucket_count());
+        });
     }
     //---------------------------------------------------------------
     std::uint64_t location_count() const noexcept {
-        return features_.value_count();
+        if(encoding_ == location_encoding::plain) {
+            return with_feature_store([] (const auto& store) {
+                return std::uint64_t(store.value_count());
+            });
+        }
+        return with_feature_store([] (const auto& store) {
+            std::uint64_t n = 0;
+            for(const auto& bucket : store) {
+                n += location_list_size(bucket.begin(), bucket.end());
+            }
+            return n;
+        });
     }
 
 
@@ -715,39 +1051,109 @@ public:
     location_list_size_statistics() const {
         auto priSize = statistics_accumulator{};
 
-        for(const auto& bucket : features_) {
-            if(!bucket.empty()) {
-                priSize += bucket.size();
-            }
-        }
+        for_each_location_list([&] (const feature&,
+                                    const location* first, const location* last)
+        {
+            priSize += last - first;
+        });
 
         return priSize;
     }
 
 
     //---------------------------------------------------------------
-    void print_feature_map(std::ostream& os) const {
-        for(const auto& bucket : features_) {
-            if(!bucket.empty()) {
-                os << std::int_least64_t(bucket.key()) << " -> ";
-                for(location p : bucket) {
-                    os << '(' << std::int_least64_t(p.tgt)
-                       << ',' << std::int_least64_t(p.win) << ')';
-                }
-                os << '\n';
+    /**
+     * @brief probe length, cluster length and location list size
+     *        histograms of the feature hash table;
+     *        finalized databases only have location list sizes,
+     *        because their lookups need no probing
+     */
+    hash_table_occupancy
+    feature_table_occupancy() const {
+        hash_table_occupancy occ;
+        if(!finalized_) {
+            if(encoding_ == location_encoding::packed) {
+                occ = packedFeatures_.occupancy();
+            } else {
+                occ = features_.occupancy();
             }
         }
+        //sizes of packed lists are in bytes
+        occ.bucketSizes.clear();
+        for_each_location_list([&] (const feature&,
+                                    const location* first, const location* last)
+        {
+            hash_table_occupancy::add(occ.bucketSizes, last - first);
+        });
+        return occ;
     }
 
 
     //---------------------------------------------------------------
-    void print_feature_counts(std::ostream& os) const {
-        for(const auto& bucket : features_) {
-            if(!bucket.empty()) {
-                os << std::int_least64_t(bucket.key()) << " -> "
-                   << std::int_least64_t(bucket.size()) << '\n';
+    void print_feature_map(std::ostream& os) const {
+        for_each_location_list([&] (const feature& f,
+                                    const location* first, const location* last)
+        {
+            os << std::int_least64_t(f) << " -> ";
+            for(; first != last; ++first) {
+                os << '(' << std::int_least64_t(first->tgt)
+                   << ',' << std::int_least64_t(first->win) << ')';
             }
-        }
+            os << '\n';
+        });
+    }
+
+
+    //---------------------------------------------------------------
+    void print_feature_counts(std::ostream& os) const {
+        for_each_location_list([&] (const feature& f,
+                                    const location* first, const location* last)
+        {
+            os << std::int_least64_t(f) << " -> "
+               << std::int_least64_t(last - first) << '\n';
+        });
+    }
+
+
+    //---------------------------------------------------------------
+    /// @brief calls 'consume(feature)' for each feature with locations
+    template<class Consumer>
+    void for_each_feature(Consumer&& consume) const {
+        for_each_location_list([&] (const feature& f,
+                                    const location*, const location*)
+        {
+            consume(f);
+        });
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief sets the number of threads that insert features into
+     *        the hash table while targets are added
+     */
+    void insertion_concurrency(unsigned n) noexcept {
+        insertionConcurrency_ = n > 0 ? n : 1;
+    }
+    //-----------------------------------------------------
+    unsigned insertion_concurrency() const noexcept {
+        return insertionConcurrency_;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief if enabled, the feature table grows a few buckets at a time
+     *        while targets are added instead of all at once;
+     *        the old table is kept until all of its buckets are moved,
+     *        so this doesn't lower the peak memory usage
+     */
+    void incremental_rehash(bool yes) noexcept {
+        incrementalRehash_ = yes;
+    }
+    //-----------------------------------------------------
+    bool incremental_rehash() const noexcept {
+        return incrementalRehash_;
     }
 
 
@@ -755,6 +1161,8 @@ public:
     void wait_until_add_target_complete() {
         // destroy inserter
         inserter_ = nullptr;
+        // lookups & iteration need all buckets in one table
+        features_.incremental_rehash(false);
     }
 
 
@@ -765,19 +1173,288 @@ public:
 
 
 private:
+    //---------------------------------------------------------------
+    /**
+     * @brief calls 'consume(feature, first, last)' for each non-empty
+     *        location list [first,last) regardless of the list encoding
+     */
+    template<class Consumer>
+    void for_each_location_list(Consumer&& consume) const
+    {
+        match_locations locs;
+        with_feature_store([&] (const auto& store) {
+            for(const auto& bucket : store) {
+                if(!bucket.empty()) {
+                    const auto l = location_range(bucket.begin(), bucket.end(), locs);
+                    consume(bucket.key(), l.first, l.second);
+                }
+            }
+        });
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief calls 'process(part, first, last)' for at most 'concurrency'
+     *        consecutive bucket ranges [first,last) of 'store' in parallel
+     * @return number of ranges (parts)
+     */
+    template<class Store, class Process>
+    static unsigned
+    for_each_bucket_range(Store& store, unsigned concurrency, Process&& process)
+    {
+        const std::uint64_t n = std::distance(store.begin(), store.end());
+        //not worth starting threads
+        if(concurrency < 2 || n < 65536) {
+            process(0u, store.begin(), store.end());
+            return 1;
+        }
+        const std::uint64_t width = (n + concurrency - 1) / concurrency;
+
+        std::vector<std::future<void>> workers;
+        workers.reserve(concurrency);
+        unsigned part = 0;
+        auto first = store.begin();
+        for(std::uint64_t pos = 0; pos < n; pos += width, ++part) {
+            auto last = std::next(first, std::min(width, n - pos));
+            workers.push_back(std::async(std::launch::async,
+                [&process,part,first,last] { process(part, first, last); }));
+            first = last;
+        }
+        for(auto& w : workers) w.get();
+        return part;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief  erases all features whose location lists [first,last)
+     *         satisfy 'pred(first, last)'
+     * @details location lists are examined by up to 'concurrency' threads;
+     *          each thread uses its own copy of 'pred'
+     * @return number of erased features
+     */
+    template<class Predicate>
+    feature_count_type erase_features_if(Predicate&& pred,
+                                         unsigned concurrency = 1)
+    {
+        feature_count_type rem = 0;
+        with_feature_store([&] (auto& store) {
+            using iterator = typename std::decay_t<decltype(store)>::iterator;
+
+            std::vector<std::vector<iterator>> erasable(std::max(1u, concurrency));
+
+            for_each_bucket_range(store, concurrency,
+                [&] (unsigned part, iterator i, iterator e) {
+                    auto p = pred;
+                    match_locations locs;
+                    for(; i != e; ++i) {
+                        if(!i->empty()) {
+                            const auto l = location_range(i->begin(), i->end(), locs);
+                            if(p(l.first, l.second)) erasable[part].push_back(i);
+                        }
+                    }
+                });
+
+            //changes table state => single-threaded
+            for(const auto& part : erasable) {
+                for(auto i : part) {
+                    erase_feature(store, i);
+                    ++rem;
+                }
+            }
+        });
+        return rem;
+    }
+
+
+    //---------------------------------------------------------------
+    /// @brief appends (decoded) locations of a non-empty bucket to 'out'
+    static void
+    append_locations(const location* first, const location* last,
+                     match_locations& out)
+    {
+        out.insert(out.end(), first, last);
+    }
+    //-----------------------------------------------------
+    static void
+    append_locations(const std::uint8_t* first, const std::uint8_t*,
+                     match_locations& out)
+    {
+        unpack_locations(first, out);
+    }
+
+    //-----------------------------------------------------
+    static std::uint64_t
+    location_list_size(const location* first, const location* last) noexcept {
+        return std::uint64_t(last - first);
+    }
+    //-----------------------------------------------------
+    static std::uint64_t
+    location_list_size(const std::uint8_t* first,
+                       const std::uint8_t* last) noexcept
+    {
+        return first != last ? packed_location_count(first) : 0;
+    }
+
+    //-----------------------------------------------------
+    template<class Store, class Iterator>
+    static void
+    erase_feature(Store& store, Iterator i) {
+        store.erase(i);
+    }
+    //-----------------------------------------------------
+    /// @brief perfect hash index can't erase keys; only their locations
+    template<class V, class S, class Iterator>
+    static void
+    erase_feature(perfect_hash_multimap<feature,V,S>& store, Iterator i) {
+        store.clear(i);
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief  keeps only the first n locations of a bucket;
+     *         only modifies the bucket's values, not the table
+     * @return new bucket size
+     */
+    template<class Iterator>
+    static std::size_t
+    shrunk_location_list(Iterator i, bucket_size_type n, const location*,
+                         match_locations&, std::vector<std::uint8_t>&)
+    {
+        return std::min(std::size_t(i->size()), std::size_t(n));
+    }
+    //-----------------------------------------------------
+    template<class Iterator>
+    static std::size_t
+    shrunk_location_list(Iterator i, bucket_size_type n, const std::uint8_t*,
+                         match_locations& locs, std::vector<std::uint8_t>& bytes)
+    {
+        if(i->empty() || packed_location_count(i->begin()) <= n) {
+            return i->size();
+        }
+        //re-encoded list never needs more bytes than before
+        locs.clear();
+        unpack_locations(i->begin(), locs);
+        bytes.clear();
+        pack_locations(locs.data(), locs.data() + n, bytes);
+        std::copy(bytes.begin(), bytes.end(), i->begin());
+        return bytes.size();
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @return location range of a non-empty bucket;
+     *         packed lists are decoded into 'buffer'
+     */
+    static std::pair<const location*,const location*>
+    location_range(const location* first, const location* last,
+                   match_locations&)
+    {
+        return {first, last};
+    }
+    //-----------------------------------------------------
+    static std::pair<const location*,const location*>
+    location_range(const std::uint8_t* first, const std::uint8_t*,
+                   match_locations& buffer)
+    {
+        buffer.clear();
+        unpack_locations(first, buffer);
+        return {buffer.data(), buffer.data() + buffer.size()};
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief packed location list layout (all numbers are LEB128 varints):
+     *        number of locations,
+     *        target & window of the first location,
+     *        target delta & window (or window delta if the target is the
+     *        same as the previous one) of all other locations;
+     *        lists have to be sorted, empty lists need no bytes at all
+     */
+    static void
+    append_varint(std::uint64_t x, std::vector<std::uint8_t>& out)
+    {
+        while(x > 0x7f) {
+            out.push_back(std::uint8_t(x | 0x80));
+            x >>= 7;
+        }
+        out.push_back(std::uint8_t(x));
+    }
+    //-----------------------------------------------------
+    static std::uint64_t
+    read_varint(const std::uint8_t*& in) noexcept
+    {
+        //most deltas fit into a single byte
+        if(*in < 0x80) return *in++;
+
+        std::uint64_t x = 0;
+        int shift = 0;
+        do {
+            x |= std::uint64_t(*in & 0x7f) << shift;
+            shift += 7;
+        } while(*in++ & 0x80);
+        return x;
+    }
+    //-----------------------------------------------------
+    static void
+    pack_locations(const location* first, const location* last,
+                   std::vector<std::uint8_t>& out)
+    {
+        if(first == last) return;
+
+        append_varint(std::uint64_t(last - first), out);
+        append_varint(first->tgt, out);
+        append_varint(first->win, out);
+        for(auto prev = first++; first != last; prev = first++) {
+            const auto dtgt = std::uint64_t(first->tgt - prev->tgt);
+            append_varint(dtgt, out);
+            append_varint(dtgt > 0 ? first->win : first->win - prev->win, out);
+        }
+    }
+    //-----------------------------------------------------
+    /// @brief appends all locations of a non-empty packed list to 'out'
+    static void
+    unpack_locations(const std::uint8_t* in, match_locations& out)
+    {
+        const auto n = read_varint(in);
+        const auto offset = out.size();
+        out.resize(offset + n);
+        auto loc = out.begin() + offset;
+
+        loc->tgt = target_id(read_varint(in));
+        loc->win = window_id(read_varint(in));
+        for(auto prev = loc++, end = out.end(); loc != end; prev = loc++) {
+            const auto dtgt = read_varint(in);
+            loc->tgt = target_id(prev->tgt + dtgt);
+            loc->win = window_id(dtgt > 0 ? read_varint(in)
+                                          : prev->win + read_varint(in));
+        }
+    }
+    //-----------------------------------------------------
+    static std::uint64_t
+    packed_location_count(const std::uint8_t* in) noexcept {
+        return read_varint(in);
+    }
+
+
     //---------------------------------------------------------------
     window_id add_all_window_sketches(const sequence& seq, target_id tgt) {
         if(!inserter_) make_sketch_inserter();
 
+        using std::begin;
+        using std::end;
+
         window_id win = 0;
-        targetSketcher_.for_each_sketch(seq,
-            [&, this] (auto&& sk) {
+        sketch buffer;
+        targetSketcher_.for_each_sketch(begin(seq), end(seq), buffer,
+            [&, this] (const auto& sk) {
                 if(inserter_->valid()) {
-                    //insert sketch into batch
+                    //insert sketch into batch (reuses its storage)
                     auto& sketch = inserter_->next_item();
                     sketch.tgt = tgt;
                     sketch.win = win;
-                    sketch.sk = std::move(sk);
+                    sketch.sk = sk;
                 }
                 ++win;
             });
@@ -785,8 +1462,50 @@ private:
     }
 
 
+    //---------------------------------------------------------------
+    window_id add_window_sketches(std::vector<sketch>&& sketches, target_id tgt) {
+        if(!inserter_) make_sketch_inserter();
+
+        window_id win = 0;
+        for(auto& sk : sketches) {
+            if(inserter_->valid()) {
+                //insert sketch into batch
+                auto& sketch = inserter_->next_item();
+                sketch.tgt = tgt;
+                sketch.win = win;
+                sketch.sk = std::move(sk);
+            }
+            ++win;
+        }
+        return win;
+    }
+
+
+    //---------------------------------------------------------------
+    void add_target_taxon(taxon_name sid, taxon_id parentTaxid,
+                          file_source source);
+
+
+    //---------------------------------------------------------------
+    /// @brief merges counted feature occurrences into sorted location counts
+    void merge_counted_features();
+
+
     //---------------------------------------------------------------
     void add_sketch_batch(const sketch_batch& batch) {
+        if(insertionConcurrency_ > 1) {
+            std::vector<std::pair<feature,location>> features;
+            for(const auto& windowSketch : batch) {
+                for(const auto& f : windowSketch.sk) {
+                    features.emplace_back(
+                        f, location{windowSketch.win, windowSketch.tgt});
+                }
+            }
+            features_.insert_concurrently(features, maxLocsPerFeature_,
+                                          insertionConcurrency_);
+            return;
+        }
+
         for(const auto& windowSketch : batch) {
             //insert features from sketch into database
             for(const auto& f : windowSketch.sk) {
@@ -800,10 +1519,19 @@ private:
     }
 
 
+    //---------------------------------------------------------------
+    /// @brief true, if the feature store in use can be copied once more
+    bool feature_store_copyable() const;
+
+
     //---------------------------------------------------------------
     void make_sketch_inserter() {
+        //growing the table stalls the inserter unless rehashing is incremental
+        features_.incremental_rehash(incrementalRehash_);
+
         batch_processing_options execOpt;
-        execOpt.batch_size(1000);
+        //larger batches amortize the thread startup of concurrent insertion
+        execOpt.batch_size(1000 * insertionConcurrency_);
         execOpt.queue_size(100);
         execOpt.concurrency(1);
 
@@ -900,12 +1628,25 @@ private:
     sketcher targetSketcher_;
     sketcher querySketcher_;
     std::uint64_t maxLocsPerFeature_;
+    file_layout layout_;
+    location_encoding encoding_;
+    bool finalized_;
+    memory_policy memoryPolicy_;
+    unsigned insertionConcurrency_;
+    bool incrementalRehash_;
     feature_store features_;
+    packed_feature_store packedFeatures_;
+    static_feature_store staticFeatures_;
+    static_packed_feature_store staticPackedFeatures_;
     std::vector<const taxon*> targets_;
     taxonomy taxa_;
     mutable ranked_lineages_cache ranksCache_;
     mutable ranked_lineages_of_targets targetLineages_;
     std::map<taxon_name,const taxon*> name2tax_;
+    std::vector<std::unique_ptr<feature_store_replica>> replicas_;
+    std::vector<unsigned> replicaNodes_;
+    std::vector<feature> countedFeatures_;
+    std::vector<std::pair<feature,bucket_size_type>> locationCounts_;
 
     std::unique_ptr<batch_executor<window_sketch>> inserter_;
 };
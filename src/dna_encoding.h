@@ -25,8 +25,17 @@
 
 #include <vector>
 #include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <type_traits>
+
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
 
 #include "bitmanip.h"
+#include "cpu_dispatch.h"
 
 
 namespace mc {
@@ -261,6 +270,185 @@ private:
 
 
 
+/*************************************************************************//**
+ *
+ * @brief 2-bit encoding of one nucleotide: A=0, C=1, G=2, T=3
+ *        ambiguous (non-ACGT) letters are encoded as 'A'
+ *
+ * @return 2-bit code in the lower bits, ambiguity flag in bit 2
+ *
+ *****************************************************************************/
+inline constexpr unsigned
+encode_nucleotide_2bit(char c) noexcept
+{
+    return (c == 'A' || c == 'a') ? 0u :
+           (c == 'C' || c == 'c') ? 1u :
+           (c == 'G' || c == 'g') ? 2u :
+           (c == 'T' || c == 't') ? 3u : 4u;
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief encodes up to 64 letters [first,first+n) in one pass
+ *
+ * @param codes  receives 2 bits per letter; letter i is stored in
+ *               bits 2*(i%32) and 2*(i%32)+1 of codes[i/32]
+ * @param ambig  receives 1 bit per letter; bit i is set if letter i
+ *               is not one of ACGTacgt (such letters are encoded as 'A')
+ *
+ * @details baseline variant: uses 16-letter SSE2 compares if available
+ *
+ *****************************************************************************/
+inline void
+encode_2bit_block_baseline(const char* first, int n,
+                           std::uint64_t (&codes)[2], std::uint64_t& ambig) noexcept
+{
+    codes[0] = 0;
+    codes[1] = 0;
+    ambig = 0;
+    int i = 0;
+
+#ifdef __SSE2__
+    const __m128i lower = _mm_set1_epi8(0x20);
+    for(; i + 16 <= n; i += 16) {
+        //case folding: only 'A'/'a' map to 'a', etc.
+        const __m128i v = _mm_or_si128(lower,
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + i)));
+
+        const __m128i isA = _mm_cmpeq_epi8(v, _mm_set1_epi8('a'));
+        const __m128i isC = _mm_cmpeq_epi8(v, _mm_set1_epi8('c'));
+        const __m128i isG = _mm_cmpeq_epi8(v, _mm_set1_epi8('g'));
+        const __m128i isT = _mm_cmpeq_epi8(v, _mm_set1_epi8('t'));
+
+        const auto valid = unsigned(_mm_movemask_epi8(
+            _mm_or_si128(_mm_or_si128(isA, isC), _mm_or_si128(isG, isT))));
+
+        //one 2-bit code per byte
+        __m128i x = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(isC, _mm_set1_epi8(1)),
+                         _mm_and_si128(isG, _mm_set1_epi8(2))),
+            _mm_and_si128(isT, _mm_set1_epi8(3)));
+
+        //pack: 2 letters => 4 bits per 16-bit lane,
+        //4 letters => 8 bits per 32-bit lane, 8 letters => 16 bits per half
+        x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi16(x, 6)),
+                          _mm_set1_epi16(0x000F));
+        x = _mm_and_si128(_mm_or_si128(x, _mm_srli_epi32(x, 12)),
+                          _mm_set1_epi32(0x00FF));
+        x = _mm_or_si128(x, _mm_srli_epi64(x, 24));
+
+        const auto lo = std::uint64_t(unsigned(_mm_cvtsi128_si32(x)) & 0xFFFFu);
+        const auto hi = std::uint64_t(unsigned(
+                            _mm_cvtsi128_si32(_mm_srli_si128(x, 8))) & 0xFFFFu);
+
+        codes[i >> 5] |= (lo | (hi << 16)) << (2 * (i & 31));
+        ambig |= std::uint64_t(~valid & 0xFFFFu) << i;
+    }
+#endif
+
+    for(; i < n; ++i) {
+        const auto c = encode_nucleotide_2bit(first[i]);
+        codes[i >> 5] |= std::uint64_t(c & 3u) << (2 * (i & 31));
+        ambig |= std::uint64_t(c >> 2) << i;
+    }
+}
+
+//-------------------------------------------------------------------
+/**
+ * @brief encodes up to 64 letters [first,first+n) in one pass
+ *        using the best kernel variant for the host CPU
+ *        (see 'encode_2bit_block_baseline' for the output format)
+ */
+inline void
+encode_2bit_block(const char* first, int n,
+                  std::uint64_t (&codes)[2], std::uint64_t& ambig)
+{
+    detail::encode_2bit_block_kernel(first, n, codes, ambig);
+}
+
+
+
+namespace detail {
+
+/*************************************************************************//**
+ * @brief true for iterators to contiguous char storage
+ *****************************************************************************/
+template<class It>
+struct is_contiguous_char_iterator : std::integral_constant<bool,
+    std::is_same<It,const char*>::value ||
+    std::is_same<It,char*>::value ||
+    std::is_same<It,std::string::const_iterator>::value ||
+    std::is_same<It,std::string::iterator>::value ||
+    std::is_same<It,std::vector<char>::const_iterator>::value ||
+    std::is_same<It,std::vector<char>::iterator>::value>
+{};
+
+
+/*************************************************************************//**
+ * @brief calls 'consume(code, ambiguous)' for each letter in [first,last)
+ *        generic version: one letter at a time
+ *****************************************************************************/
+template<class InputIterator, class Consumer>
+inline void
+for_each_nucleotide_2bit(InputIterator first, InputIterator last,
+                         Consumer&& consume, std::false_type)
+{
+    for(; first != last; ++first) {
+        const auto c = encode_nucleotide_2bit(*first);
+        consume(c & 3u, c >> 2);
+    }
+}
+
+//-------------------------------------------------------------------
+/// @brief contiguous storage version: encodes blocks of 64 letters
+template<class InputIterator, class Consumer>
+inline void
+for_each_nucleotide_2bit(InputIterator first, InputIterator last,
+                         Consumer&& consume, std::true_type)
+{
+    if(first == last) return;
+
+    const char* p = &*first;
+    auto remaining = std::ptrdiff_t(last - first);
+
+    std::uint64_t codes[2];
+    std::uint64_t ambig;
+
+    while(remaining > 0) {
+        const int n = int(std::min(remaining, std::ptrdiff_t(64)));
+        encode_2bit_block(p, n, codes, ambig);
+        for(int i = 0; i < n; ++i) {
+            consume(unsigned(codes[i >> 5] >> (2 * (i & 31))) & 3u,
+                    unsigned(ambig >> i) & 1u);
+        }
+        p += n;
+        remaining -= n;
+    }
+}
+
+} // namespace detail
+
+
+
+/*************************************************************************//**
+ * @brief calls 'consume(code, ambiguous)' for each letter in [first,last)
+ *        with code = 2-bit encoding (ambiguous letters are encoded as 'A')
+ *        and ambiguous = 1 for non-ACGT letters, 0 otherwise
+ *****************************************************************************/
+template<class InputIterator, class Consumer>
+inline void
+for_each_nucleotide_2bit(InputIterator first, InputIterator last,
+                         Consumer&& consume)
+{
+    detail::for_each_nucleotide_2bit(first, last,
+        std::forward<Consumer>(consume),
+        detail::is_contiguous_char_iterator<InputIterator>{});
+}
+
+
+
 /*************************************************************************//**
  * @brief loops through all 2-bit encoded k-mers in a sequence of characters
  *
@@ -281,10 +469,10 @@ for_each_kmer_2bit(numk_t k,
                   std::is_unsigned<UInt>::value,
                   "only unsigned integer types are supported");
 
-    using std::next;
-
     using ambig_t = half_size_t<UInt>;
 
+    if(k < 1) return;
+
     auto kmer    = UInt(0);
     auto kmerMsk = UInt(~0);
     kmerMsk >>= (sizeof(kmerMsk) * CHAR_BIT) - (k * 2);
@@ -293,18 +481,10 @@ for_each_kmer_2bit(numk_t k,
     auto ambigMsk = ambig_t(~0);
     ambigMsk >>= (sizeof(ambigMsk) * CHAR_BIT) - k;
 
-    ++last;
-    for(auto ssend = next(first); ssend != last; ++first, ++ssend) {
-        //encode next letter
-        kmer <<= 2;
-        ambig <<= 1;
-        switch(*first) {
-            case 'A': case 'a': break;
-            case 'C': case 'c': kmer |= 1; break;
-            case 'G': case 'g': kmer |= 2; break;
-            case 'T': case 't': kmer |= 3; break;
-            default: ambig |= 1; break;
-        }
+    for_each_nucleotide_2bit(first, last, [&] (unsigned c, unsigned a) {
+        //append next letter
+        kmer  = UInt(kmer << 2) | UInt(c);
+        ambig = ambig_t(ambig << 1) | ambig_t(a);
         --k;
         //make sure we load k letters at the beginning
         if(k == 0) {
@@ -315,7 +495,7 @@ for_each_kmer_2bit(numk_t k,
             consume(kmer, ambig);
             ++k; //we want only one letter next time
         }
-    }
+    });
 }
 
 
@@ -377,6 +557,71 @@ for_each_unambiguous_kmer_2bit(
 
 
 
+/*************************************************************************//**
+ * @brief loops through all 2-bit encoded k-mers in a sequence of characters
+ *        kmers are canonical = min(kmer, reverse_complement(kmer))
+ *
+ * @details The forward k-mer and its reverse complement are both updated
+ *          with one shift per letter instead of reversing each k-mer.
+ *          Ambiguous letters are encoded as 'A' (complement 'T') just like
+ *          in 'for_each_kmer_2bit' / 'make_reverse_complement_2bit'.
+ *
+ * @tparam UInt      result type, must be an unsigned integer type
+ * @tparam KmerSize  numk_t or std::integral_constant<numk_t,k>
+ *                   (makes masks & shifts compile-time constants)
+ *
+ * @param k        number of characters in a k-mer
+ * @param first    iterator to the first character of the input sequence
+ * @param last     iterator to one after the last character of the input sequence
+ * @param consume  function object/lambda consuming (k-mer, ambiguity bitmask)
+ *****************************************************************************/
+template<class UInt, class KmerSize, class InputIterator, class Consumer>
+inline void
+for_each_rolling_canonical_kmer_2bit(const KmerSize k,
+                                     InputIterator first, InputIterator last,
+                                     Consumer&& consume)
+{
+    static_assert(std::is_integral<UInt>::value &&
+                  std::is_unsigned<UInt>::value,
+                  "only unsigned integer types are supported");
+
+    using ambig_t = half_size_t<UInt>;
+
+    if(k < 1) return;
+
+    auto kmer    = UInt(0);
+    auto revcom  = UInt(0);
+    auto kmerMsk = UInt(~0);
+    kmerMsk >>= (sizeof(kmerMsk) * CHAR_BIT) - (k * 2);
+    //position of the first letter's complement in the reverse complement
+    const int revShift = 2 * (k - 1);
+
+    auto ambig    = ambig_t(0);  //bitfield marking ambiguous nucleotides
+    auto ambigMsk = ambig_t(~0);
+    ambigMsk >>= (sizeof(ambigMsk) * CHAR_BIT) - k;
+
+    numk_t load = k;
+    for_each_nucleotide_2bit(first, last, [&] (unsigned c, unsigned a) {
+        //append next letter
+        kmer   = UInt(kmer << 2) | UInt(c);
+        revcom = UInt(revcom >> 2) | UInt(UInt(3 - c) << revShift);
+        ambig  = ambig_t(ambig << 1) | ambig_t(a);
+
+        //make sure we load k letters at the beginning
+        if(load > 1) {
+            --load;
+        }
+        else {
+            kmer  &= kmerMsk;   //stamp out 2*k lower bits
+            ambig &= ambigMsk;  //stamp out k lower bits
+
+            consume(kmer < revcom ? kmer : revcom, ambig);
+        }
+    });
+}
+
+
+
 /*************************************************************************//**
  * @brief loops through all 2-bit encoded k-mers in a sequence of characters
  *        kmers are canonical = min(kmer, reverse_complement(kmer))
@@ -394,10 +639,8 @@ for_each_canonical_kmer_2bit(const numk_t k,
                              InputIterator first, InputIterator last,
                              Consumer&& consume)
 {
-    for_each_kmer_2bit<UInt>(k, first, last,
-        [&] (UInt kmer, half_size_t<UInt> ambig) {
-            consume(make_canonical_2bit(kmer, k), ambig);
-        });
+    for_each_rolling_canonical_kmer_2bit<UInt>(k, first, last,
+        std::forward<Consumer>(consume));
 }
 
 //-------------------------------------------------------------------
@@ -419,20 +662,21 @@ for_each_canonical_kmer_2bit(const numk_t k, InputRange input,
  *        sequence of characters
  *        kmers are canonical = min(kmer, reverse_complement(kmer))
  *
- * @tparam UInt    result type, must be an unsigned integer type
+ * @tparam UInt      result type, must be an unsigned integer type
+ * @tparam KmerSize  numk_t or std::integral_constant<numk_t,k>
  *
  * @param k        number of characters in a k-mer
  * @param input    input sequence
  * @param consume  function object (lambda, etc.) consuming the k-mers
  *****************************************************************************/
-template<class UInt, class InputIterator, class Consumer>
+template<class UInt, class KmerSize, class InputIterator, class Consumer>
 inline void
 for_each_unambiguous_canonical_kmer_2bit(
-    const numk_t k, InputIterator first, InputIterator last, Consumer&& consume)
+    const KmerSize k, InputIterator first, InputIterator last, Consumer&& consume)
 {
-    for_each_kmer_2bit<UInt>(k, first, last,
+    for_each_rolling_canonical_kmer_2bit<UInt>(k, first, last,
         [&] (UInt kmer, half_size_t<UInt> ambig) {
-            if(!ambig) consume(make_canonical_2bit(kmer, k));
+            if(!ambig) consume(kmer);
         });
 }
 
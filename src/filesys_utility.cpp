@@ -19,6 +19,11 @@
  *
  *****************************************************************************/
 #include <dirent.h> //POSIX header
+#ifndef _WIN32
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
 #include <cstring>
 #include <iterator>
 
@@ -120,5 +125,39 @@ bool file_readable(const std::string& filename)
 }
 
 
+
+//-------------------------------------------------------------------
+std::shared_ptr<char>
+map_file_region(const std::string& filename,
+                std::uint64_t offset, std::uint64_t size)
+{
+#ifdef _WIN32
+    return nullptr;
+#else
+    if(size < 1) return nullptr;
+
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) return nullptr;
+
+    //mmap requires page-aligned offsets
+    const std::uint64_t pageSize = sysconf(_SC_PAGESIZE);
+    const std::uint64_t skip = offset % pageSize;
+    const std::uint64_t length = size + skip;
+
+    void* mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                     fd, offset - skip);
+    //mapping stays valid after the file descriptor is closed
+    close(fd);
+
+    if(mem == MAP_FAILED) return nullptr;
+
+    char* base = static_cast<char*>(mem);
+
+    return std::shared_ptr<char>{base + skip,
+        [base,length](char*) { munmap(base, length); }};
+#endif
+}
+
+
 } // namespace mc
 
@@ -27,6 +27,8 @@
 #include <vector>
 #include <set>
 #include <fstream>
+#include <memory>
+#include <cstdint>
 
 
 namespace mc {
@@ -35,7 +37,7 @@ namespace mc {
 /*************************************************************************//**
  *
  * @brief
- * @details this is the only POSIX dependency (working with gcc or MinGW)
+ * @details uses POSIX dirent (working with gcc or MinGW)
  *
  *****************************************************************************/
 std::vector<std::string>
@@ -80,6 +82,25 @@ std::ifstream::pos_type file_size(const std::string& filename);
 bool file_readable(const std::string& filename);
 
 
+
+/*************************************************************************//**
+ *
+ * @brief maps a region of a file into (copy-on-write) memory;
+ *        pages are loaded lazily on first access
+ * @details POSIX only; always fails on other platforms
+ *
+ * @param offset  byte offset of the region; doesn't need to be page-aligned
+ * @param size    number of bytes in the region
+ *
+ * @return pointer to the first byte of the region that unmaps the file
+ *         when the last copy is destroyed; nullptr if mapping failed
+ *
+ *****************************************************************************/
+std::shared_ptr<char>
+map_file_region(const std::string& filename,
+                std::uint64_t offset, std::uint64_t size);
+
+
 } // namespace mc
 
 
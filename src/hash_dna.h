@@ -205,42 +205,29 @@ public:
     {
         for_each_window(first, last, windowSize_, windowStride_,
             [&] (InputIterator first, InputIterator last) {
-                using std::distance;
-                using std::begin;
-                using std::end;
-
-                const auto n = distance(first,last);
-                if(n < k_) return;
-
-                const auto s = std::min(sketchSize_, sketch_size_type(n - k_ + 1));
-                if(s < 1) return;
-
-                auto sketch = sketch_type(s, feature_type(~0));
-
-                for_each_unambiguous_canonical_kmer_2bit<kmer_type>(k_, first, last,
-                    [&] (kmer_type kmer) {
-                        auto h = hash_(kmer);
-                        if(h < sketch.back()) {
-                            auto pos = std::lower_bound(sketch.begin(), sketch.end(), h);
-                            //make sure we don't insert the same feature more than once
-                            if(pos != sketch.end() && *pos != h) {
-                                sketch.pop_back();
-                                sketch.insert(pos, h);
-                            }
-                        }
-                    });
-
-                //check if some features are invalid (in case of many ambiguous kmers)
-                if(!sketch.empty() && sketch.back() == feature_type(~0)) {
-                    for(auto i = sketch.begin(), e = sketch.end(); i != e; ++i) {
-                        if(*i == feature_type(~0)) {
-                            sketch.erase(i,sketch.end());
-                            break;
-                        }
-                    }
+                sketch_type sketch;
+                if(make_sketch(first, last, sketch)) {
+                    consume(std::move(sketch));
                 }
+            });
+    }
 
-                consume(std::move(sketch));
+    //-----------------------------------------------------
+    /**
+     * @brief sketches all windows in [first,last) using 'sketch' as storage;
+     *        'consume' gets a const reference to it, so nothing is allocated
+     *        once the capacity of 'sketch' suffices
+     */
+    template<class InputIterator, class Consumer>
+    void
+    for_each_sketch(InputIterator first, InputIterator last,
+                    sketch_type& sketch, Consumer&& consume) const
+    {
+        for_each_window(first, last, windowSize_, windowStride_,
+            [&] (InputIterator first, InputIterator last) {
+                if(make_sketch(first, last, sketch)) {
+                    consume(static_cast<const sketch_type&>(sketch));
+                }
             });
     }
 
@@ -277,6 +264,121 @@ public:
 
 
 private:
+    //---------------------------------------------------------------
+    /**
+     * @brief stores the (at most) 'sketchSize_' smallest unique features
+     *        of one window in 'sketch'
+     * @return false, if the window is too short to produce any k-mer
+     */
+    template<class InputIterator>
+    bool
+    make_sketch(InputIterator first, InputIterator last,
+                sketch_type& sketch) const
+    {
+        using std::distance;
+
+        const auto n = distance(first,last);
+        if(n < k_) return false;
+
+        const auto s = std::min(sketchSize_, sketch_size_type(n - k_ + 1));
+        if(s < 1) return false;
+
+        sketch.assign(s, feature_type(~0));
+        feature_type* const sk = sketch.data();
+
+        //kernels with compile-time constants for standard parameter sets
+        if(!fill_sketch_fixed<16,16>(first, last, sk, s) &&
+           !fill_sketch_fixed<32,32>(first, last, sk, s))
+        {
+            fill_sketch(k_, s, first, last, sk);
+        }
+
+        //check if some features are invalid (in case of many ambiguous kmers)
+        if(sketch.back() == feature_type(~0)) {
+            sketch.erase(std::find(sketch.begin(), sketch.end(),
+                                   feature_type(~0)), sketch.end());
+        }
+        return true;
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief uses kernel specialized for k-mer size K and sketch size S
+     * @return false, if the parameters don't match (or K is unsupported)
+     */
+    template<kmer_size_type K, sketch_size_type S, class InputIterator>
+    bool
+    fill_sketch_fixed(InputIterator first, InputIterator last,
+                      feature_type* sk, sketch_size_type s) const
+    {
+        return fill_sketch_fixed<K,S>(first, last, sk, s,
+            std::integral_constant<bool,(K <= max_kmer_size())>{});
+    }
+    //-----------------------------------------------------
+    template<kmer_size_type K, sketch_size_type S, class InputIterator>
+    bool
+    fill_sketch_fixed(InputIterator first, InputIterator last,
+                      feature_type* sk, sketch_size_type s,
+                      std::true_type) const
+    {
+        if(k_ != K || s != S) return false;
+        fill_sketch(std::integral_constant<kmer_size_type,K>{},
+                    std::integral_constant<sketch_size_type,S>{},
+                    first, last, sk);
+        return true;
+    }
+    //-----------------------------------------------------
+    template<kmer_size_type K, sketch_size_type S, class InputIterator>
+    bool
+    fill_sketch_fixed(InputIterator, InputIterator, feature_type*,
+                      sketch_size_type, std::false_type) const
+    {
+        return false;
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief inserts the smallest unique features of all k-mers in
+     *        [first,last) into sorted sketch [sk,sk+s)
+     * @tparam KmerSize    kmer_size_type or std::integral_constant
+     * @tparam SketchSize  sketch_size_type or std::integral_constant
+     */
+    template<class KmerSize, class SketchSize, class InputIterator>
+    void
+    fill_sketch(KmerSize k, SketchSize s,
+                InputIterator first, InputIterator last,
+                feature_type* sk) const
+    {
+        for_each_unambiguous_canonical_kmer_2bit<kmer_type>(k, first, last,
+            [&] (kmer_type kmer) {
+                const auto h = hash_(kmer);
+                if(h < sk[s-1]) insert_unique_sorted(sk, s, h);
+            });
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief inserts 'h' into sorted [sk,sk+s) and drops the last element,
+     *        unless 'h' is already present; requires h < sk[s-1]
+     */
+    template<class SketchSize>
+    static void
+    insert_unique_sorted(feature_type* sk, SketchSize s,
+                         feature_type h) noexcept
+    {
+        //branch-free count of smaller features
+        //(fully unrolled if 's' is a compile-time constant)
+        sketch_size_type pos = 0;
+        for(sketch_size_type i = 0; i < s; ++i) pos += (sk[i] < h);
+
+        //make sure we don't insert the same feature more than once
+        if(sk[pos] == h) return;
+
+        std::copy_backward(sk + pos, sk + s - 1, sk + s);
+        sk[pos] = h;
+    }
+
+
     //---------------------------------------------------------------
     hasher hash_;
     kmer_size_type k_;
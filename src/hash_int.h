@@ -23,7 +23,9 @@
 #define MC_HASHES_H_
 
 
+#include <climits>
 #include <cstdint>
+#include <string>
 #include <utility>
 
 
@@ -204,6 +206,92 @@ struct to32bits_hash<std::uint64_t> {
 };
 
 
+/*************************************************************************//**
+ *
+ * @brief integer hash functions that can be selected at runtime
+ *
+ *****************************************************************************/
+enum class int_hash : std::uint8_t {
+    same_size, identity, murmur3, splitmix64
+};
+
+constexpr int_hash last_int_hash() noexcept { return int_hash::splitmix64; }
+
+
+//-------------------------------------------------------------------
+inline std::string
+to_string(int_hash h)
+{
+    switch(h) {
+        default:
+        case int_hash::same_size:  return "same-size";
+        case int_hash::identity:   return "identity";
+        case int_hash::murmur3:    return "murmur3";
+        case int_hash::splitmix64: return "splitmix64";
+    }
+}
+
+//-------------------------------------------------------------------
+inline std::string
+int_hash_names()
+{
+    std::string names;
+    for(int i = 0; i <= int(last_int_hash()); ++i) {
+        if(i > 0) names += ", ";
+        names += to_string(int_hash(i));
+    }
+    return names;
+}
+
+//-------------------------------------------------------------------
+/// @return false, if name is unknown
+inline bool
+int_hash_from_name(const std::string& name, int_hash& h)
+{
+    for(int i = 0; i <= int(last_int_hash()); ++i) {
+        if(name == to_string(int_hash(i))) {
+            h = int_hash(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief same number of output bits as input bits;
+ *        hash function can be selected at runtime
+ *
+ *****************************************************************************/
+template<class T>
+class selectable_hash
+{
+public:
+    explicit
+    selectable_hash(int_hash f = int_hash::same_size) noexcept : f_{f} {}
+
+    int_hash function() const noexcept { return f_; }
+
+    T operator () (T x) const noexcept {
+        switch(f_) {
+            default:
+            case int_hash::same_size:  return same_size_hash<T>{}(x);
+            case int_hash::identity:   return x;
+            case int_hash::murmur3:    return murmur3_fmix(x);
+            case int_hash::splitmix64:
+                //upper bits are mixed best
+                return T(splitmix64_hash(std::uint64_t(x)) >>
+                         (64 - sizeof(T) * CHAR_BIT));
+        }
+    }
+
+private:
+    int_hash f_;
+};
+
+
 } // namespace mc
 
 
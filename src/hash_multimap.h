@@ -29,13 +29,19 @@
 #include <functional>
 #include <atomic>
 #include <mutex>
+#include <future>
 #include <iostream>
 #include <type_traits>
 #include <memory>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
 
 #include "chunk_allocator.h"
+#include "memory_policy.h"
 #include "io_serialize.h"
 #include "cmdline_utility.h"
+#include "filesys_utility.h"
 
 
 namespace mc {
@@ -59,6 +65,38 @@ check_supports_reserve(char);
 template<class T>
 struct supports_reserve : public decltype(check_supports_reserve<T>(0)) {};
 
+
+//-------------------------------------------------------------------
+template<class T>
+constexpr auto
+check_supports_adopt(int)
+    -> decltype(std::declval<T>().adopt(
+                    std::shared_ptr<typename T::value_type>{}, std::size_t(1)),
+                std::true_type{});
+
+template<class>
+constexpr std::false_type
+check_supports_adopt(char);
+
+template<class T>
+struct supports_adopt : public decltype(check_supports_adopt<T>(0)) {};
+
+
+//-------------------------------------------------------------------
+template<class T>
+constexpr auto
+check_supports_handles(int)
+    -> decltype(std::declval<T>().allocate_handle(std::size_t(1)),
+                std::true_type{});
+
+template<class>
+constexpr std::false_type
+check_supports_handles(char);
+
+template<class T>
+struct supports_handles : public decltype(check_supports_handles<T>(0)) {};
+
+
 } // namespace detail
 
 //-------------------------------------------------------------------
@@ -77,6 +115,101 @@ struct allocator_config<Alloc,true>
 };
 
 
+//-------------------------------------------------------------------
+template<class Alloc, bool = detail::supports_adopt<Alloc>::value>
+struct allocator_adoption
+{
+    static constexpr bool supported() noexcept { return false; }
+
+    template<class T>
+    static bool adopt(Alloc&, std::shared_ptr<T>, std::size_t) {
+        return false;
+    }
+};
+
+template<class Alloc>
+struct allocator_adoption<Alloc,true>
+{
+    static constexpr bool supported() noexcept { return true; }
+
+    template<class T>
+    static bool adopt(Alloc& alloc, std::shared_ptr<T> mem, std::size_t n) {
+        return alloc.adopt(std::move(mem), n);
+    }
+};
+
+
+//-------------------------------------------------------------------
+/**
+ * @brief buckets refer to their value arrays with pointers or,
+ *        if the allocator supports it, with (smaller) handles
+ */
+template<class Alloc, bool = detail::supports_handles<Alloc>::value>
+struct value_reference
+{
+    using value_type = typename Alloc::value_type;
+    using type = value_type*;
+
+    static value_type* address(type p) noexcept { return p; }
+
+    static type allocate(Alloc& alloc, std::size_t n) {
+        return std::allocator_traits<Alloc>::allocate(alloc, n);
+    }
+    static void deallocate(Alloc& alloc, type p, std::size_t n) {
+        std::allocator_traits<Alloc>::deallocate(alloc, p, n);
+    }
+
+    static type from_pointer(const Alloc&, value_type* p) noexcept { return p; }
+
+    static constexpr bool addressable(std::size_t) noexcept { return true; }
+
+    /// @brief never dereferenced
+    static type erased() noexcept {
+        static value_type marker;
+        return &marker;
+    }
+    static type key_only() noexcept { return nullptr; }
+};
+
+template<class Alloc>
+struct value_reference<Alloc,true>
+{
+    using value_type = typename Alloc::value_type;
+    using type = typename Alloc::handle_type;
+
+    static value_type* address(type h) noexcept { return Alloc::address(h); }
+
+    static type allocate(Alloc& alloc, std::size_t n) {
+        return alloc.allocate_handle(n);
+    }
+    static void deallocate(Alloc& alloc, type h, std::size_t n) {
+        alloc.deallocate_handle(h, n);
+    }
+
+    static type from_pointer(const Alloc& alloc, value_type* p) noexcept {
+        return alloc.handle(p);
+    }
+
+    /// @brief handles are shared by all allocators in a process
+    static bool addressable(std::size_t n) { return Alloc::addressable(n); }
+
+    static constexpr type erased() noexcept { return Alloc::reserved_handle(0); }
+    /// @brief marks buckets without values, if no values fit into a bucket
+    static constexpr type key_only() noexcept { return Alloc::reserved_handle(1); }
+};
+
+
+
+
+/*************************************************************************//**
+ *
+ * @brief identifies how a probing scheme places keys in hash table slots
+ *
+ *****************************************************************************/
+enum class probing_kind : std::uint8_t {
+    quadratic, linear, cuckoo
+};
+
 
 
 /*************************************************************************//**
@@ -88,6 +221,8 @@ struct allocator_config<Alloc,true>
  *****************************************************************************/
 struct linear_probing
 {
+    static constexpr probing_kind kind = probing_kind::linear;
+
     template<class RAIterator>
     class iterator
     {
@@ -145,6 +280,8 @@ struct linear_probing
  *****************************************************************************/
 struct single_pass_quadratic_probing
 {
+    static constexpr probing_kind kind = probing_kind::quadratic;
+
     template<class RAIterator>
     class iterator
     {
@@ -195,6 +332,83 @@ struct single_pass_quadratic_probing
 
 
 
+/*************************************************************************//**
+ *
+ * @brief  bucketized cuckoo hashing: each key can only be stored in one of
+ *         two bins of 4 consecutive slots; lookups check at most 8 slots
+ *         (only 4 if the first bin is not full); insertions into two full
+ *         bins move other keys to their alternative bins
+ *
+ *****************************************************************************/
+struct cuckoo_probing : public linear_probing
+{
+    static constexpr probing_kind kind = probing_kind::cuckoo;
+    static constexpr std::size_t cuckoo_bin_size = 4;
+};
+
+
+
+/*************************************************************************//**
+ *
+ * @brief helpers for cuckoo based probing
+ *
+ *****************************************************************************/
+namespace detail {
+
+template<class P>
+constexpr auto
+check_uses_cuckoo_bins(int) -> decltype(P::cuckoo_bin_size, std::true_type{});
+
+template<class>
+constexpr std::false_type
+check_uses_cuckoo_bins(char);
+
+template<class P>
+struct uses_cuckoo_bins : public decltype(check_uses_cuckoo_bins<P>(0)) {};
+
+template<class P, bool = uses_cuckoo_bins<P>::value>
+struct cuckoo_config {
+    static constexpr std::size_t bin_size = 1;
+};
+
+template<class P>
+struct cuckoo_config<P,true> {
+    static constexpr std::size_t bin_size = P::cuckoo_bin_size;
+};
+
+
+} // namespace detail
+
+
+
+/*************************************************************************//**
+ *
+ * @brief histograms (length or size -> number of occurrences)
+ *        that show how well the keys of a hash table are spread
+ *
+ *****************************************************************************/
+struct hash_table_occupancy
+{
+    using histogram = std::vector<std::uint64_t>;
+
+    /// @brief slots inspected before a key is found (one entry per key)
+    histogram hitProbes;
+    /// @brief occupied slots passed by lookups of absent keys
+    ///        (one entry per possible home slot)
+    histogram missProbes;
+    /// @brief runs of consecutive occupied (or erased) slots
+    histogram clusters;
+    /// @brief number of values per key
+    histogram bucketSizes;
+
+    static void add(histogram& h, std::uint64_t x) {
+        if(x >= h.size()) h.resize(x+1, 0);
+        ++h[x];
+    }
+};
+
+
+
 /*************************************************************************//**
  *
  * @brief   (integer) key -> value hashed multimap
@@ -236,6 +450,7 @@ class hash_multimap
 
     using value_alloc  = std::allocator_traits<ValueAllocator>;
     using alloc_config = allocator_config<ValueAllocator>;
+    using alloc_adoption = allocator_adoption<ValueAllocator>;
 
 public:
     //---------------------------------------------------------------
@@ -256,7 +471,8 @@ public:
 
 
     /****************************************************************
-     * @brief bucket = key + dynamic array
+     * @brief bucket = key + dynamic array;
+     *        small value lists are stored in place of the array pointer
      */
     class bucket_type
     {
@@ -271,17 +487,69 @@ public:
         using iterator         = value_type*;
         using const_iterator   = const value_type*;
 
+    private:
+        //-----------------------------------------------------
+        using value_refs = value_reference<value_allocator>;
+        using value_ref  = typename value_refs::type;
+
+        static constexpr bool compact =
+            detail::supports_handles<value_allocator>::value;
+
+        static constexpr std::size_t ref_size = sizeof(value_ref);
+
+        static constexpr std::size_t local_size = compact
+            ? ref_size / sizeof(value_type)
+            : (ref_size > sizeof(value_type) ? ref_size / sizeof(value_type) : 1);
+
+        union inline_storage {
+            inline_storage() noexcept : values{} {}
+
+            value_type*       local()       noexcept { return local_; }
+            const value_type* local() const noexcept { return local_; }
+
+            value_ref values;
+            value_type local_[local_size > 0 ? local_size : 1];
+        };
+
+        /// @brief for values that are larger than a handle
+        struct reference_storage {
+            reference_storage() noexcept : values{} {}
+
+            value_type*       local()       noexcept { return nullptr; }
+            const value_type* local() const noexcept { return nullptr; }
+
+            value_ref values;
+        };
+
+        using value_storage = std::conditional_t<(local_size > 0),
+                                  inline_storage, reference_storage>;
+
+    public:
+
         bucket_type():
-            values_{nullptr}, key_{},
+            storage_{}, key_{},
             size_(0), capacity_(0)
         {}
         bucket_type(key_type&& key):
-            values_{nullptr}, key_{std::move(key)},
+            storage_{}, key_{std::move(key)},
             size_(0), capacity_(0)
         {}
 
-        bool unused() const noexcept { return !values_; }
+        /// @brief number of values that can be stored without allocation
+        static constexpr size_type
+        inline_capacity() noexcept {
+            return size_type(sizeof(value_storage) / sizeof(value_type));
+        }
+
+        bool unused() const noexcept {
+            return (capacity_ < 1) &&
+                (inline_capacity() > 0 || storage_.values != value_refs::key_only());
+        }
         bool empty()  const noexcept { return (size_ < 1); }
+        /// @brief unused slot whose key was erased (probing continues)
+        bool erased() const noexcept {
+            return unused() && storage_.values != value_ref{};
+        }
 
         size_type size()     const noexcept { return size_; }
         size_type capacity() const noexcept { return capacity_; }
@@ -290,26 +558,46 @@ public:
         const key_type& key() const noexcept { return key_; }
 
         reference
-        operator [](size_type i) noexcept { return values_[i]; }
+        operator [](size_type i) noexcept { return data()[i]; }
 
         const_reference
-        operator [](size_type i) const noexcept { return values_[i]; }
+        operator [](size_type i) const noexcept { return data()[i]; }
 
         //-------------------------------------------
-              iterator  begin()       noexcept { return values_; }
-        const_iterator  begin() const noexcept { return values_; }
-        const_iterator cbegin() const noexcept { return values_; }
+              iterator  begin()       noexcept { return data(); }
+        const_iterator  begin() const noexcept { return data(); }
+        const_iterator cbegin() const noexcept { return data(); }
 
-              iterator  end()       noexcept { return values_ + size_; }
-        const_iterator  end() const noexcept { return values_ + size_; }
-        const_iterator cend() const noexcept { return values_ + size_; }
+              iterator  end()       noexcept { return data() + size_; }
+        const_iterator  end() const noexcept { return data() + size_; }
+        const_iterator cend() const noexcept { return data() + size_; }
 
     private:
+        //-----------------------------------------------------
+        bool stored_inline() const noexcept {
+            return capacity_ <= inline_capacity();
+        }
+        //-------------------------------------------
+        value_type* data() noexcept {
+            return stored_inline() ? storage_.local()
+                                   : value_refs::address(storage_.values);
+        }
+        const value_type* data() const noexcept {
+            return stored_inline() ? storage_.local()
+                                   : value_refs::address(storage_.values);
+        }
+        //-------------------------------------------
+        void make_inline() noexcept {
+            capacity_ = inline_capacity();
+            //without inline values a key-only bucket needs a marker
+            if(inline_capacity() < 1) storage_.values = value_refs::key_only();
+        }
+
         //-----------------------------------------------------
         template<class V>
         bool insert(value_allocator& alloc, V&& v) {
             if(!reserve(alloc, size_+1)) return false;
-            values_[size_] = std::forward<V>(v);
+            data()[size_] = std::forward<V>(v);
             ++size_;
             return true;
         }
@@ -321,31 +609,61 @@ public:
             using std::distance;
             auto nsize = size_ + size_type(distance(first,last));
             if(!reserve(alloc, nsize)) return false;
-            for(auto p = values_+size_; first != last; ++p, ++first) {
+            for(auto p = data()+size_; first != last; ++p, ++first) {
                 *p = *first;
             }
             size_ = nsize;
             return true;
         }
         //-------------------------------------------
-        bool insert(value_allocator&,
+        /// @brief uses external memory; small value lists are copied
+        bool insert(value_allocator& alloc,
                     value_type* values, size_type size, size_type capacity)
         {
-            values_ = values;
+            if(capacity <= inline_capacity()) {
+                if(inline_capacity() > 0) {
+                    std::copy(values, values + size, storage_.local());
+                }
+                make_inline();
+            } else {
+                storage_.values = value_refs::from_pointer(alloc, values);
+                capacity_ = capacity;
+            }
             size_ = size;
-            capacity_ = capacity;
+            return true;
+        }
+        //-------------------------------------------
+        /// @brief takes over values (storage) of another bucket
+        bool insert(value_allocator&, bucket_type&& src) noexcept {
+            storage_ = src.storage_;
+            size_ = src.size_;
+            capacity_ = src.capacity_;
+            src.storage_.values = value_ref{};
+            src.size_ = 0;
+            src.capacity_ = 0;
             return true;
         }
 
         //-------------------------------------------
         void free(value_allocator& alloc) {
-            if(!values_) return;
             deallocate(alloc);
-            values_ = nullptr;
+            storage_.values = value_ref{};
+            size_ = 0;
+            capacity_ = 0;
+        }
+        //-------------------------------------------
+        /// @brief frees values and leaves a tombstone; key is kept
+        void erase(value_allocator& alloc) {
+            deallocate(alloc);
+            storage_.values = erased_marker();
             size_ = 0;
             capacity_ = 0;
         }
         //-------------------------------------------
+        static value_ref erased_marker() noexcept {
+            return value_refs::erased();
+        }
+        //-------------------------------------------
         void clear() {
             size_ = 0;
         }
@@ -364,7 +682,8 @@ public:
 
         //-----------------------------------------------------
         void deallocate(value_allocator& alloc) {
-            value_alloc::deallocate(alloc, values_, capacity_);
+            if(stored_inline()) return;
+            value_refs::deallocate(alloc, storage_.values, capacity_);
         }
 
         //-----------------------------------------------------
@@ -377,26 +696,29 @@ public:
                     auto ncap = std::size_t(n + 0.3*size_);
                     if(ncap > max_bucket_size()) ncap = max_bucket_size();
                     //make new array and copy old values
-                    auto nvals = value_alloc::allocate(alloc, ncap);
+                    auto nvals = value_refs::allocate(alloc, ncap);
                     if(!nvals) return false;
-                    std::copy(values_, values_ + size_, nvals);
+                    std::copy(begin(), end(), value_refs::address(nvals));
                     deallocate(alloc);
-                    values_ = nvals;
+                    storage_.values = nvals;
                     capacity_ = size_type(ncap);
                 }
             }
+            else if(n <= inline_capacity()) {
+                make_inline();
+            }
             else {
                 //make new array
-                auto nvals = value_alloc::allocate(alloc, n);
+                auto nvals = value_refs::allocate(alloc, n);
                 if(!nvals) return false;
-                values_ = nvals;
+                storage_.values = nvals;
                 capacity_ = size_type(n);
             }
             return true;
         }
 
         //-----------------------------------------------------
-        value_type* values_;
+        value_storage storage_;
         key_type key_;
         size_type size_;
         size_type capacity_;
@@ -429,6 +751,12 @@ private:
     //-----------------------------------------------------
     using probing_iterator = typename ProbingScheme::template iterator<iterator>;
 
+    static constexpr bool cuckoo = detail::uses_cuckoo_bins<ProbingScheme>::value;
+    static constexpr size_type cuckoo_bin_size =
+        detail::cuckoo_config<ProbingScheme>::bin_size;
+    /// @brief insertions may move buckets of other keys to different slots
+    static constexpr bool displaces_buckets = cuckoo;
+
 
 public:
     //---------------------------------------------------------------
@@ -436,11 +764,12 @@ public:
     hash_multimap(const value_allocator& valloc = value_allocator{},
                   const bucket_allocator& kalloc = bucket_allocator{})
     :
-        numKeys_(0), numValues_(0),
+        numKeys_(0), numValues_(0), numErased_(0),
         batchSize_(default_batch_size()),
         maxLoadFactor_(default_max_load_factor()),
         hash_{}, keyEqual_{}, alloc_{valloc},
-        buckets_{kalloc}
+        buckets_{kalloc},
+        rehashSource_{}, rehashPos_(0), incrementalRehash_(false)
     {
         buckets_.resize(1500007);
     }
@@ -451,11 +780,12 @@ public:
                   const value_allocator& valloc = value_allocator{},
                   const bucket_allocator& kalloc = bucket_allocator{})
     :
-        numKeys_(0), numValues_(0),
+        numKeys_(0), numValues_(0), numErased_(0),
         batchSize_(default_batch_size()),
         maxLoadFactor_(default_max_load_factor()),
         hash_{}, keyEqual_{keyComp}, alloc_{valloc},
-        buckets_{kalloc}
+        buckets_{kalloc},
+        rehashSource_{}, rehashPos_(0), incrementalRehash_(false)
     {
         buckets_.resize(1500007);
     }
@@ -467,11 +797,12 @@ public:
                   const value_allocator& valloc = value_allocator{},
                   const bucket_allocator& kalloc = bucket_allocator{})
     :
-        numKeys_(0), numValues_(0),
+        numKeys_(0), numValues_(0), numErased_(0),
         batchSize_(default_batch_size()),
         maxLoadFactor_(default_max_load_factor()),
         hash_{hash}, keyEqual_{keyComp}, alloc_{valloc},
-        buckets_{kalloc}
+        buckets_{kalloc},
+        rehashSource_{}, rehashPos_(0), incrementalRehash_(false)
     {
         buckets_.resize(1500007);
     }
@@ -483,11 +814,12 @@ private:
                   const value_allocator& valloc = value_allocator{},
                   const bucket_allocator& kalloc = bucket_allocator{})
     :
-        numKeys_(0), numValues_(0),
+        numKeys_(0), numValues_(0), numErased_(0),
         batchSize_(default_batch_size()),
         maxLoadFactor_(default_max_load_factor()),
         hash_{}, keyEqual_{}, alloc_{valloc},
-        buckets_{kalloc}
+        buckets_{kalloc},
+        rehashSource_{}, rehashPos_(0), incrementalRehash_(false)
     {
         buckets_.resize(numKeys);
     }
@@ -495,17 +827,27 @@ private:
 public:
     //-------------------------------------------------------------------
     hash_multimap(const hash_multimap& src):
-        numKeys_(0), numValues_(0),
+        numKeys_(0), numValues_(0), numErased_(0),
+        batchSize_(src.batchSize_),
         maxLoadFactor_(src.maxLoadFactor_),
         hash_{src.hash_}, keyEqual_{src.keyEqual_},
         alloc_{value_alloc::select_on_container_copy_construction(src.alloc_)},
-        buckets_{}
+        buckets_{},
+        rehashSource_{}, rehashPos_(0),
+        incrementalRehash_(src.incrementalRehash_)
     {
         reserve_keys(src.numKeys_);
-        reserve_values(src.numValues_);
+        //small value lists are stored inside the buckets
+        reserve_values(src.out_of_line_value_count());
 
         for(const auto& b : src.buckets_) {
-            if(!b.unused()) insert(b.key(), b.begin(), b.end());
+            if(!b.unused()) copy_bucket(b);
+        }
+        //buckets that were not yet migrated by an incremental rehash
+        if(src.rehashSource_) {
+            for(const auto& b : src.rehashSource_->buckets_) {
+                if(!b.unused()) copy_bucket(b);
+            }
         }
     }
 
@@ -513,11 +855,16 @@ public:
     //-----------------------------------------------------
     hash_multimap(hash_multimap&& src):
         numKeys_(src.numKeys_), numValues_(src.numValues_),
+        numErased_(src.numErased_),
+        batchSize_(src.batchSize_),
         maxLoadFactor_(src.maxLoadFactor_),
         hash_{std::move(src.hash_)},
         keyEqual_{std::move(src.keyEqual_)},
         alloc_{std::move(src.alloc_)},
-        buckets_{std::move(src.buckets_)}
+        buckets_{std::move(src.buckets_)},
+        rehashSource_{std::move(src.rehashSource_)},
+        rehashPos_(src.rehashPos_),
+        incrementalRehash_(src.incrementalRehash_)
     { }
 
 
@@ -534,17 +881,24 @@ public:
     {
         numKeys_ = src.numKeys_;
         numValues_ = src.numValues_;
+        numErased_ = src.numErased_;
+        batchSize_ = src.batchSize_;
         maxLoadFactor_ = src.maxLoadFactor_;
         hash_ = std::move(src.hash_);
         keyEqual_ = std::move(src.keyEqual_);
         alloc_ = std::move(src.alloc_);
         buckets_ = std::move(src.buckets_);
+        discard_rehash_source();
+        rehashSource_ = std::move(src.rehashSource_);
+        rehashPos_ = src.rehashPos_;
+        incrementalRehash_ = src.incrementalRehash_;
         return *this;
     }
 
 
     //-------------------------------------------------------------------
     ~hash_multimap() {
+        discard_rehash_source();
         for(auto& b : buckets_) {
             b.deallocate(alloc_);
         }
@@ -599,6 +953,112 @@ public:
     }
 
 
+    //---------------------------------------------------------------
+    /**
+     * @brief the slot of a key depends on the probing scheme and,
+     *        for cuckoo probing, on the number of slots per bin
+     */
+    static constexpr probing_kind probing() noexcept {
+        return ProbingScheme::kind;
+    }
+    //-----------------------------------------------------
+    static constexpr size_type probing_bin_size() noexcept {
+        return cuckoo_bin_size;
+    }
+    //-----------------------------------------------------
+    /// @brief buckets refer to their values with handles instead of pointers
+    static constexpr bool compact_buckets() noexcept {
+        return detail::supports_handles<value_allocator>::value;
+    }
+    //-----------------------------------------------------
+    /**
+     * @return true, if the values can be copied into another map
+     *         (copy, 'compact'); with compact buckets all maps of a
+     *         process share 2^32 value handles
+     */
+    bool values_copyable() const {
+        return value_reference<value_allocator>::addressable(
+                   out_of_line_value_count());
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @return number of slots that a lookup of the bucket's key
+     *         inspects before it reaches the bucket
+     */
+    size_type probe_length(const_iterator it) const
+    {
+        if(it->unused()) return 0;
+        if(rehashSource_ && !owns(it)) return rehashSource_->probe_length(it);
+
+        const auto self = const_cast<hash_multimap*>(this);
+        const auto hashValue = hash_(it->key());
+        const auto slot = size_type(it - buckets_.begin());
+
+        if(cuckoo) {
+            const auto bins = cuckoo_bins(hashValue);
+            const auto primary = cuckoo_bin_slots(bins.first);
+            if(cuckoo_bin_of_slot(slot) == bins.first) {
+                return slot - primary.first;
+            }
+            return (primary.second - primary.first) +
+                   (slot - cuckoo_bin_slots(bins.second).first);
+        }
+
+        probing_iterator pit {
+            self->buckets_.begin() + (hashValue % buckets_.size()),
+            self->buckets_.begin(), self->buckets_.end()};
+
+        size_type steps = 0;
+        do {
+            if(size_type(iterator(pit) - self->buckets_.begin()) == slot) return steps;
+            ++steps;
+        } while(++pit);
+
+        return steps;
+    }
+
+
+    /****************************************************************
+     * @brief collects probe length, cluster length and bucket size
+     *        histograms; needs a completed migration (see 'complete_rehash')
+     */
+    hash_table_occupancy occupancy() const
+    {
+        hash_table_occupancy occ;
+
+        const size_type n = buckets_.size();
+        if(n < 1) return occ;
+
+        for(auto it = buckets_.begin(); it != buckets_.end(); ++it) {
+            if(it->unused()) continue;
+            hash_table_occupancy::add(occ.hitProbes, probe_length(it));
+            hash_table_occupancy::add(occ.bucketSizes, it->size());
+        }
+
+        for(size_type home = 0; home < n; ++home) {
+            hash_table_occupancy::add(occ.missProbes, miss_probe_length(home));
+        }
+
+        //clusters can wrap around => start after an empty slot
+        size_type start = 0;
+        while(start < n && !is_empty_slot(start)) ++start;
+        size_type run = 0;
+        for(size_type i = 0; i < n; ++i) {
+            const auto slot = (start + 1 + i) % n;
+            if(is_empty_slot(slot)) {
+                if(run > 0) hash_table_occupancy::add(occ.clusters, run);
+                run = 0;
+            } else {
+                ++run;
+            }
+        }
+        if(run > 0) hash_table_occupancy::add(occ.clusters, run);
+
+        return occ;
+    }
+
+
     /****************************************************************
      * @brief if the value_allocator supports pre-allocation
      *        storage space for 'n' values will be allocated
@@ -633,82 +1093,294 @@ public:
      */
     bool rehash(size_type n)
     {
+        complete_rehash();
         if(!rehash_possible(n)) return false;
-
-        //make temporary new map
-        //buckets resize might throw
-        hash_multimap newmap{n};
-        newmap.maxLoadFactor_ = maxLoadFactor_;
-
-        //move old bucket contents into new hash slots
-        //this should use only non-throwing operations
-        for(auto& b : buckets_) {
-            if(!b.unused()) {
-                newmap.insert_into_slot(std::move(b.key_),
-                                        b.values_, b.size_, b.capacity_);
-            }
-        }
-
-        //should all be noexcept
-        buckets_ = std::move(newmap.buckets_);
-        hash_ = std::move(newmap.hash_);
+        rehash_buckets(n);
         return true;
     }
 
 
-    //---------------------------------------------------------------
-    iterator
-    insert(const key_type& key, const value_type& value)
-    {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(key, value);
-    }
-    iterator
-    insert(const key_type& key, value_type&& value)
+    /****************************************************************
+     * @brief if enabled, the buckets of a growing table are not moved to
+     *        the new table all at once, but a few at a time during each
+     *        of the subsequent insertions; lookups have to check the old
+     *        table as long as not all buckets are migrated
+     *
+     * @details Iteration over all buckets and (de-)serialization need a
+     *          completed migration (see 'complete_rehash').
+     *          Disabling incremental rehashing completes the migration.
+     *          Not supported by cuckoo probing, because its insertions
+     *          might have to rehash at any time.
+     */
+    void incremental_rehash(bool yes)
     {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(key, std::move(value));
+        incrementalRehash_ = yes && !cuckoo;
+        if(!yes) complete_rehash();
     }
-    iterator
-    insert(key_type&& key, const value_type& value)
-    {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(std::move(key), value);
+    //-----------------------------------------------------
+    bool incremental_rehash() const noexcept {
+        return incrementalRehash_;
     }
-    iterator
-    insert(key_type&& key, value_type&& value)
-    {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(std::move(key), std::move(value));
+    //-----------------------------------------------------
+    /// @brief true, if an incremental rehash is still in progress
+    bool rehashing() const noexcept {
+        return bool(rehashSource_);
     }
-
     //-----------------------------------------------------
-    template<class InputIterator, class EndSentinel>
-    iterator
-    insert(const key_type& key, InputIterator first, EndSentinel last)
+    /// @brief migrates all remaining buckets of an incremental rehash
+    void complete_rehash()
     {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(key, first, last);
+        if(rehashSource_) migrate_buckets(rehashSource_->bucket_count());
     }
-    template<class InputIterator, class EndSentinel>
-    iterator
-    insert(key_type&& key, InputIterator first, EndSentinel last)
-    {
-        make_sure_enough_buckets_left(1);
-        return insert_into_slot(std::move(key), first, last);
+    //-----------------------------------------------------
+    /// @brief number of old slots that are migrated with each insertion
+    static constexpr size_type rehash_step() noexcept {
+        return 16;
     }
 
 
     /****************************************************************
-     * @brief discards values with indices n-1 ... size-1
-     *        in the bucket associated with 'key'
+     * @brief  inserts a batch of (key,value) pairs using multiple threads;
+     *         values are discarded if their bucket is already holding
+     *         'maxValuesPerKey' many values
+     *
+     * @details Each thread owns a contiguous range of hash table slots and
+     *          inserts all pairs with a home slot in that range. Pairs whose
+     *          probing sequence leaves the range are inserted afterwards by
+     *          the calling thread. The order of values within a bucket is
+     *          the same as with sequential insertion.
+     *          Insertions that need to (re-)allocate a value array are
+     *          serialized, since value allocators are not synchronized.
      */
-    void
-    shrink(const key_type& key, bucket_size_type n)
+    void insert_concurrently(
+        const std::vector<std::pair<key_type,value_type>>& pairs,
+        size_type maxValuesPerKey, unsigned concurrency)
     {
-        auto it = find(key);
-        if(it != end()) shrink(it,n);
-    }
+        if(pairs.empty()) return;
+
+        //there might be fewer new keys than pairs, but we can't rehash later
+        make_sure_enough_buckets_left(pairs.size());
+
+        //workers only see the current table
+        if(rehashSource_) {
+            migrate_buckets(pairs.size() * rehash_step());
+            if(rehashSource_) {
+                for(const auto& p : pairs) migrate_key(p.first);
+            }
+        }
+
+        const std::uint64_t numPartitions = std::min(std::uint64_t(concurrency),
+                                                     std::uint64_t(pairs.size()));
+
+        //buckets of other partitions might be displaced
+        if(numPartitions < 2 || displaces_buckets) {
+            for(const auto& p : pairs) {
+                auto it = insert_into_slot(p.first, p.second);
+                if(it != buckets_.end()) shrink(it, maxValuesPerKey);
+            }
+            return;
+        }
+
+        const std::uint64_t partitionWidth =
+            (buckets_.size() + numPartitions - 1) / numPartitions;
+
+        //group pairs by slot range (stable => keeps value order)
+        std::vector<std::uint64_t> slots(pairs.size());
+        std::vector<std::uint64_t> order(pairs.size());
+        std::vector<std::uint64_t> partitionBegin(numPartitions+1, 0);
+
+        for(std::size_t i = 0; i < pairs.size(); ++i) {
+            slots[i] = hash_(pairs[i].first) % buckets_.size();
+            ++partitionBegin[1 + slots[i] / partitionWidth];
+        }
+        for(std::uint64_t p = 1; p <= numPartitions; ++p) {
+            partitionBegin[p] += partitionBegin[p-1];
+        }
+        {
+            auto pos = partitionBegin;
+            for(std::size_t i = 0; i < pairs.size(); ++i) {
+                order[pos[slots[i] / partitionWidth]++] = i;
+            }
+        }
+
+        std::vector<std::vector<std::uint64_t>> deferred(numPartitions);
+        std::vector<size_type> newKeys(numPartitions, 0);
+        std::vector<size_type> newValues(numPartitions, 0);
+
+        //only guards the value allocator
+        std::mutex allocMutex;
+        auto insert_value = [&] (bucket_type& b, const value_type& v) {
+            const bool allocates = b.unused()
+                ? bucket_type::inline_capacity() < 1
+                : b.size() >= b.capacity();
+            if(!allocates) return b.insert(alloc_, v);
+            std::lock_guard<std::mutex> lock(allocMutex);
+            return b.insert(alloc_, v);
+        };
+
+        std::vector<std::future<void>> workers;
+        workers.reserve(numPartitions);
+
+        for(std::uint64_t p = 0; p < numPartitions; ++p) {
+            workers.push_back(std::async(std::launch::async, [&,p] {
+                const auto first = size_type(p * partitionWidth);
+                const auto last  = size_type(std::min((p+1) * partitionWidth,
+                                             std::uint64_t(buckets_.size())));
+
+                for(auto j = partitionBegin[p]; j < partitionBegin[p+1]; ++j) {
+                    const auto i = order[j];
+                    const auto& key = pairs[i].first;
+
+                    auto it = find_slot_in_range(key, slots[i], first, last);
+
+                    if(it == buckets_.end()) {
+                        deferred[p].push_back(i);
+                    }
+                    else if(it->unused()) {
+                        if(insert_value(*it, pairs[i].second)) {
+                            it->key_ = key;
+                            ++newKeys[p];
+                            ++newValues[p];
+                        }
+                    }
+                    else if(it->size() < maxValuesPerKey) {
+                        if(insert_value(*it, pairs[i].second)) ++newValues[p];
+                    }
+                }
+            }));
+        }
+        for(auto& w : workers) w.get();
+
+        for(std::uint64_t p = 0; p < numPartitions; ++p) {
+            numKeys_ += newKeys[p];
+            numValues_ += newValues[p];
+        }
+
+        //keys are always deferred by the same partition => order is kept
+        for(const auto& part : deferred) {
+            for(auto i : part) {
+                auto it = insert_into_slot(pairs[i].first, pairs[i].second);
+                if(it != buckets_.end()) shrink(it, maxValuesPerKey);
+            }
+        }
+    }
+
+
+    /****************************************************************
+     * @brief  inserts all new keys with empty buckets whose value arrays
+     *         can hold exactly the given number of values, so that
+     *         subsequent insertions need neither rehashing nor
+     *         reallocation of value arrays
+     *
+     * @details Value arrays are allocated in slot order from one
+     *          pre-allocated memory block (if the value allocator supports
+     *          reservation, as the default chunk_allocator does).
+     *          Buckets of keys that are already present are not modified.
+     *
+     * @param  counts: (key, number of values) pairs with unique keys
+     * @param  maxInsertBatch: number of keys that can be inserted
+     *         in one batch afterwards without rehashing
+     *
+     * @return false, if not all value arrays could be pre-allocated
+     */
+    bool reserve_exactly(
+        const std::vector<std::pair<key_type,bucket_size_type>>& counts,
+        size_type maxInsertBatch = 1)
+    {
+        if(counts.empty()) return true;
+
+        reserve_keys(numKeys_ + counts.size() + maxInsertBatch);
+
+        //insert keys; value arrays are assigned afterwards
+        std::uint64_t nvalues = 0;
+        for(const auto& c : counts) {
+            if(c.second < 1 || find(c.first) != end()) continue;
+
+            while(insert_into_slot(c.first, static_cast<value_type*>(nullptr),
+                                   bucket_size_type(0), c.second) == end())
+            {
+                //probing sequence exhausted (possible at high load factors)
+                rehash(size_type(1 + 1.1 * bucket_count()));
+            }
+
+            if(c.second > bucket_type::inline_capacity()) nvalues += c.second;
+        }
+        if(nvalues < 1) return true;
+
+        const bool reserved = reserve_values(nvalues);
+
+        bool complete = true;
+        for(auto& b : buckets_) {
+            if(b.unused() || b.stored_inline() || b.storage_.values) continue;
+            //without reservation each array would be allocated separately
+            auto values = reserved
+                ? bucket_type::value_refs::allocate(alloc_, b.capacity_)
+                : typename bucket_type::value_ref{};
+            if(values) {
+                b.storage_.values = values;
+            } else {
+                //array will grow on demand
+                b.make_inline();
+                complete = false;
+            }
+        }
+        return complete;
+    }
+
+
+    //---------------------------------------------------------------
+    iterator
+    insert(const key_type& key, const value_type& value)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(key, value);
+    }
+    iterator
+    insert(const key_type& key, value_type&& value)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(key, std::move(value));
+    }
+    iterator
+    insert(key_type&& key, const value_type& value)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(std::move(key), value);
+    }
+    iterator
+    insert(key_type&& key, value_type&& value)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(std::move(key), std::move(value));
+    }
+
+    //-----------------------------------------------------
+    template<class InputIterator, class EndSentinel>
+    iterator
+    insert(const key_type& key, InputIterator first, EndSentinel last)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(key, first, last);
+    }
+    template<class InputIterator, class EndSentinel>
+    iterator
+    insert(key_type&& key, InputIterator first, EndSentinel last)
+    {
+        prepare_insertion(key);
+        return insert_into_slot(std::move(key), first, last);
+    }
+
+
+    /****************************************************************
+     * @brief discards values with indices n-1 ... size-1
+     *        in the bucket associated with 'key'
+     */
+    void
+    shrink(const key_type& key, bucket_size_type n)
+    {
+        auto it = find(key);
+        if(it != end()) shrink(it,n);
+    }
     //-----------------------------------------------------
     void
     shrink(const_iterator it, bucket_size_type n)
@@ -735,10 +1407,64 @@ public:
     }
 
 
+    /****************************************************************
+     * @brief  removes key and all its values;
+     *         the slot is only reclaimed by the next rehash / compaction
+     * @return number of erased values
+     */
+    size_type
+    erase(const key_type& key)
+    {
+        if(rehashSource_) migrate_key(key);
+        auto it = find_occupied_slot(key);
+        return (it != end()) ? erase(const_iterator(it)) : 0;
+    }
+    //-----------------------------------------------------
+    size_type
+    erase(const_iterator it)
+    {
+        if(it->unused()) return 0;
+        const auto n = it->size();
+        //bucket might still be in the table that is being migrated
+        if(rehashSource_ && !owns(it)) {
+            const auto key = it->key();
+            migrate_key(key);
+            it = find_occupied_slot(key);
+        }
+        const_cast<bucket_type*>(&(*it))->erase(alloc_);
+        --numKeys_;
+        ++numErased_;
+        numValues_ -= n;
+        return n;
+    }
+    //-----------------------------------------------------
+    /// @brief number of slots occupied by erased keys
+    size_type erased_count() const noexcept {
+        return numErased_;
+    }
+
+
+    /****************************************************************
+     * @brief rebuilds the hash table without erased slots;
+     *        values are copied into freshly reserved memory, so that
+     *        memory of erased and shrunk value lists is given back
+     * @return false, if there are not enough value handles left
+     *         for the temporary copy (see 'values_copyable')
+     */
+    bool compact()
+    {
+        if(!values_copyable()) return false;
+        hash_multimap tmp{*this};
+        swap(tmp);
+        return true;
+    }
+
+
     //---------------------------------------------------------------
     void clear()
     {
-        if(numKeys_ < 1) return;
+        discard_rehash_source();
+        if(numKeys_ < 1 && numErased_ < 1) return;
 
         //free bucket memory
         for(auto& b : buckets_) {
@@ -746,6 +1472,7 @@ public:
         }
         numKeys_ = 0;
         numValues_ = 0;
+        numErased_ = 0;
     }
 
 
@@ -756,13 +1483,15 @@ public:
      */
     void clear_without_deallocation()
     {
+        discard_rehash_source(false);
         for(auto& b : buckets_) {
-            b.values_ = nullptr;
+            b.storage_.values = typename bucket_type::value_ref{};
             b.size_ = 0;
             b.capacity_ = 0;
         }
         numKeys_ = 0;
         numValues_ = 0;
+        numErased_ = 0;
     }
 
 
@@ -796,6 +1525,62 @@ public:
             const_cast<hash_multimap*>(this)->find_occupied_slot(key) );
     }
 
+    //-----------------------------------------------------
+    /**
+     * @brief   looks up a range of keys and calls 'consume(key, bucket_iter)'
+     *          for each of them in order (bucket_iter == end() if not found)
+     *
+     * @details Keys are processed in groups: first all keys are hashed and
+     *          their home slots are prefetched, then the probing sequences
+     *          are resolved and the value arrays of all found buckets are
+     *          prefetched, so that the cache misses of all lookups within
+     *          a group overlap instead of occurring one after the other.
+     *
+     * @tparam  ForwardIterator : iterator over keys; must be multi-pass
+     */
+    template<class ForwardIterator, class Consumer>
+    void
+    find_batch(ForwardIterator first, ForwardIterator last,
+               Consumer&& consume) const
+    {
+        auto self = const_cast<hash_multimap*>(this);
+
+        using hash_value_t = std::decay_t<decltype(hash_(*first))>;
+
+        hash_value_t hashes[find_batch_size()];
+        iterator found[find_batch_size()];
+
+        while(first != last) {
+            const auto groupBegin = first;
+            std::size_t n = 0;
+
+            for(; n < find_batch_size() && first != last; ++n, ++first) {
+                hashes[n] = hash_(*first);
+                const size_type slot = hashes[n] % buckets_.size();
+                prefetch(&buckets_[slot]);
+            }
+
+            auto key = groupBegin;
+            for(std::size_t i = 0; i < n; ++i, ++key) {
+                found[i] = self->find_occupied_slot(*key, hashes[i]);
+                if(found[i] != self->buckets_.end()) {
+                    prefetch(found[i]->begin());
+                }
+            }
+
+            key = groupBegin;
+            for(std::size_t i = 0; i < n; ++i, ++key) {
+                consume(*key, const_iterator(found[i]));
+            }
+        }
+    }
+
+    //-----------------------------------------------------
+    /// @brief maximum number of lookups that overlap in 'find_batch'
+    static constexpr std::size_t find_batch_size() noexcept {
+        return 32;
+    }
+
     //-----------------------------------------------------
     size_type
     count(const key_type& key) const {
@@ -848,6 +1633,17 @@ public:
     hash_function() const noexcept {
         return hash_;
     }
+    //-----------------------------------------------------
+    /// @brief replaces the hash function; all keys are rehashed
+    void hash_function(const hasher& hash)
+    {
+        complete_rehash();
+        hash_ = hash;
+        if(numKeys_ > 0 || numErased_ > 0) {
+            //same bucket count wouldn't be rehashed
+            rehash(buckets_.size() + 1);
+        }
+    }
 
 
     //---------------------------------------------------------------
@@ -903,11 +1699,16 @@ public:
     {
         std::swap(numKeys_, other.numKeys_);
         std::swap(numValues_, other.numValues_);
+        std::swap(numErased_, other.numErased_);
+        std::swap(batchSize_, other.batchSize_);
         std::swap(maxLoadFactor_, other.maxLoadFactor_);
         std::swap(hash_, other.hash_);
         std::swap(keyEqual_, other.keyEqual_);
         std::swap(alloc_, other.alloc_);
         std::swap(buckets_, other.buckets_);
+        std::swap(rehashSource_, other.rehashSource_);
+        std::swap(rehashPos_, other.rehashPos_);
+        std::swap(incrementalRehash_, other.incrementalRehash_);
     }
 
 
@@ -915,7 +1716,18 @@ public:
      * @brief deserialize hashmap from input stream
      */
     friend void read_binary(std::istream& is, hash_multimap& m) {
-        m.deserialize(is);
+        m.deserialize(is, 1);
+    }
+
+    /****************************************************************
+     * @brief deserialize hashmap from input stream;
+     *        buckets are inserted by 'concurrency' many threads
+     *        while the next batch is read ahead
+     */
+    friend void read_binary(std::istream& is, hash_multimap& m,
+                            unsigned concurrency)
+    {
+        m.deserialize(is, concurrency);
     }
 
     /****************************************************************
@@ -925,6 +1737,28 @@ public:
         m.serialize(os);
     }
 
+    /****************************************************************
+     * @brief deserialize hashmap that was written with
+     *        'write_binary_layout' from input stream;
+     *        if the stream's file name is given and the allocator
+     *        supports it, large value lists are memory-mapped instead
+     *        of read
+     */
+    friend void read_binary_layout(std::istream& is, hash_multimap& m,
+                                   const std::string& filename = "")
+    {
+        m.deserialize_layout(is, filename);
+    }
+
+    /****************************************************************
+     * @brief serialize hashmap to output stream preserving the
+     *        in-memory bucket layout (no rehashing needed when loading)
+     */
+    friend void write_binary_layout(std::ostream& os, const hash_multimap& m)
+    {
+        m.serialize_layout(os);
+    }
+
 
     //---------------------------------------------------------------
     static constexpr size_type default_batch_size() noexcept {
@@ -938,42 +1772,252 @@ public:
 
 private:
     //---------------------------------------------------------------
+    /**
+     * @brief  value lists that don't fit into a bucket are copied to
+     *         'storage' (which is advanced); small ones are left in place,
+     *         they will be copied into their bucket on insertion
+     * @return location of the values
+     */
+    static value_type*
+    stash_values(value_type* values, bucket_size_type size,
+                 value_type*& storage)
+    {
+        if(size <= bucket_type::inline_capacity()) return values;
+        auto target = storage;
+        std::copy(values, values + size, target);
+        storage += size;
+        return target;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief  reads and inserts 'batchSize' buckets
+     * @return number of values read
+     */
     std::uint64_t deserialize_batch_of_buckets(
         std::istream& is,
         std::vector<key_type>& keyBuffer,
         std::vector<bucket_size_type>& sizeBuffer,
+        std::vector<value_type>& valueBuffer,
         std::uint64_t batchSize,
-        value_type * valuesOffset)
+        value_type *& valuesOffset)
     {
-        auto batchValuesOffset = valuesOffset;
-
         //load batch
         read_binary(is, keyBuffer.data(), batchSize);
         read_binary(is, sizeBuffer.data(), batchSize);
 
+        std::uint64_t batchValuesCount = 0;
+        for(std::uint64_t i = 0; i < batchSize; ++i) {
+            batchValuesCount += sizeBuffer[i];
+        }
+        valueBuffer.resize(batchValuesCount);
+        read_binary(is, valueBuffer.data(), batchValuesCount);
+
         //insert batch
+        auto values = valueBuffer.data();
         for(std::uint64_t i = 0; i < batchSize; ++i) {
             const auto& bucketSize = sizeBuffer[i];
 
             if(bucketSize > 0) {
                 const auto& key = keyBuffer[i];
+                const auto stashed = stash_values(values, bucketSize, valuesOffset);
+
+                while(insert_into_slot(key, stashed, bucketSize, bucketSize) ==
+                      buckets_.end())
+                {
+                    //probing sequence exhausted (possible at high load factors)
+                    rehash_buckets(grown_bucket_count(buckets_.size()));
+                }
+
+                values += bucketSize;
+            }
+        }
+
+        return batchValuesCount;
+    }
+
+
+    //---------------------------------------------------------------
+    /// @brief one batch of buckets grouped by hash table slot ranges
+    struct deserialization_batch
+    {
+        std::vector<key_type> keys;
+        std::vector<bucket_size_type> sizes;
+        std::vector<value_type> valueBuffer;
+        std::vector<value_type*> values;
+        std::vector<std::uint64_t> slots;
+        //key indices sorted by slot range (partition)
+        std::vector<std::uint64_t> order;
+        std::vector<std::uint64_t> partitionBegin;
+    };
+
+    //---------------------------------------------------------------
+    /**
+     * @brief reads keys, sizes & values of 'batchSize' buckets and
+     *        groups them by slot ranges of width 'partitionWidth'
+     * @return number of values read
+     */
+    std::uint64_t read_deserialization_batch(
+        std::istream& is, deserialization_batch& batch,
+        std::uint64_t batchSize, value_type *& valuesOffset,
+        std::uint64_t numPartitions, std::uint64_t partitionWidth)
+    {
+        batch.keys.resize(batchSize);
+        batch.sizes.resize(batchSize);
+        batch.values.resize(batchSize);
+        batch.slots.resize(batchSize);
+        batch.order.resize(batchSize);
+        batch.partitionBegin.assign(numPartitions+1, 0);
+
+        read_binary(is, batch.keys.data(), batchSize);
+        read_binary(is, batch.sizes.data(), batchSize);
 
-                auto it = insert_into_slot(key, valuesOffset, bucketSize, bucketSize);
-                if(it == buckets_.end())
-                    std::cerr << "could not insert key " << key << '\n';
+        std::uint64_t batchValuesCount = 0;
+        for(std::uint64_t i = 0; i < batchSize; ++i) {
+            batchValuesCount += batch.sizes[i];
+        }
+        batch.valueBuffer.resize(batchValuesCount);
+        read_binary(is, batch.valueBuffer.data(), batchValuesCount);
 
-                valuesOffset += bucketSize;
+        auto values = batch.valueBuffer.data();
+        for(std::uint64_t i = 0; i < batchSize; ++i) {
+            batch.values[i] = stash_values(values, batch.sizes[i], valuesOffset);
+            values += batch.sizes[i];
+            batch.slots[i] = hash_(batch.keys[i]) % buckets_.size();
+            ++batch.partitionBegin[1 + batch.slots[i] / partitionWidth];
+        }
+        //counting sort by partition
+        for(std::uint64_t p = 1; p <= numPartitions; ++p) {
+            batch.partitionBegin[p] += batch.partitionBegin[p-1];
+        }
+        {
+            auto pos = batch.partitionBegin;
+            for(std::uint64_t i = 0; i < batchSize; ++i) {
+                batch.order[pos[batch.slots[i] / partitionWidth]++] = i;
             }
         }
-        std::uint64_t batchValuesCount = valuesOffset - batchValuesOffset;
-        read_binary(is, batchValuesOffset, batchValuesCount);
 
         return batchValuesCount;
     }
 
 
     //---------------------------------------------------------------
-    void deserialize(std::istream& is)
+    /**
+     * @brief inserts all buckets of one partition of a batch;
+     *        only slots in range [first,last) are modified, so different
+     *        partitions can be processed concurrently
+     */
+    void insert_deserialization_partition(
+        const deserialization_batch& batch, std::uint64_t partition,
+        size_type first, size_type last,
+        std::vector<bucket_type>& deferred)
+    {
+        for(auto j = batch.partitionBegin[partition],
+                 e = batch.partitionBegin[partition+1]; j < e; ++j)
+        {
+            const auto i = batch.order[j];
+            const auto size = batch.sizes[i];
+            if(size < 1) continue;
+
+            const auto& key = batch.keys[i];
+
+            auto it = find_slot_in_range(key, batch.slots[i], first, last);
+            if(it != buckets_.end() && it->unused()) {
+                it->insert(alloc_, batch.values[i], size, size);
+                it->key_ = key;
+            } else {
+                //values might only be in the batch's buffer
+                bucket_type b;
+                b.insert(alloc_, batch.values[i], size, size);
+                b.key_ = key;
+                deferred.push_back(std::move(b));
+            }
+        }
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief multi-threaded deserialization: batches are read (ahead) by
+     *        the calling thread, buckets are inserted by worker threads
+     *        that each own a contiguous range of hash table slots;
+     *        buckets whose probing sequence leaves their slot range are
+     *        deferred and inserted after all batches have been processed
+     */
+    void deserialize_concurrently(
+        std::istream& is, std::uint64_t nkeys, std::uint64_t nvalues,
+        std::uint64_t batchSize, value_type * valuesOffset,
+        unsigned concurrency)
+    {
+        using len_t = std::uint64_t;
+
+        const len_t numPartitions = std::min(len_t(concurrency),
+                                             len_t(buckets_.size()));
+        const len_t partitionWidth =
+            (buckets_.size() + numPartitions - 1) / numPartitions;
+
+        const len_t totalSize = nkeys*(sizeof(key_type)+sizeof(bucket_size_type))
+                              + nvalues*sizeof(value_type);
+        len_t indicator = 0;
+
+        std::vector<std::vector<bucket_type>> deferred(numPartitions);
+        std::vector<std::future<void>> workers;
+        workers.reserve(numPartitions);
+
+        deserialization_batch current;
+        deserialization_batch next;
+
+        len_t remaining = nkeys;
+        auto read_next = [&] (deserialization_batch& batch) {
+            const len_t n = std::min(remaining, batchSize);
+            auto numValues = read_deserialization_batch(
+                is, batch, n, valuesOffset, numPartitions, partitionWidth);
+            remaining -= n;
+            indicator += n*(sizeof(key_type)+sizeof(bucket_size_type))
+                       + numValues*sizeof(value_type);
+        };
+
+        read_next(current);
+
+        while(!current.keys.empty()) {
+            for(len_t p = 0; p < numPartitions; ++p) {
+                workers.push_back(std::async(std::launch::async, [&,p] {
+                    insert_deserialization_partition(current, p,
+                        size_type(p * partitionWidth),
+                        size_type(std::min((p+1) * partitionWidth,
+                                           len_t(buckets_.size()))),
+                        deferred[p]);
+                }));
+            }
+            //read ahead
+            if(remaining > 0) {
+                read_next(next);
+            } else {
+                next.keys.clear();
+            }
+
+            for(auto& w : workers) w.get();
+            workers.clear();
+
+            show_progress_indicator(std::cerr, float(indicator)/totalSize);
+
+            std::swap(current, next);
+        }
+
+        for(auto& part : deferred) {
+            for(auto& b : part) {
+                while(insert_into_slot(b.key(), std::move(b)) == buckets_.end()) {
+                    //probing sequence exhausted (possible at high load factors)
+                    rehash_buckets(grown_bucket_count(buckets_.size()));
+                }
+            }
+        }
+    }
+
+
+    //---------------------------------------------------------------
+    void deserialize(std::istream& is, unsigned concurrency)
     {
         using len_t = std::uint64_t;
 
@@ -997,30 +2041,37 @@ private:
             //if the allocator supports it: reserve one large memory chunk
             //for all values; individual buckets will then point into this
             //array; the default chunk_allocator does this
+            //(values of small buckets are stored in the buckets themselves,
+            //so the end of the chunk might never be used)
             reserve_keys(nkeys);
             reserve_values(nvalues);
             auto valuesOffset = alloc_.allocate(nvalues);
 
-            {// read keys & bucket sizes & values in batches
+            if(concurrency > 1 && !displaces_buckets) {
+                deserialize_concurrently(is, nkeys, nvalues, batchSize,
+                                         valuesOffset, concurrency);
+            }
+            else {// read keys & bucket sizes & values in batches
                 const len_t numFullBatches = nkeys / batchSize;
                 const len_t lastBatchSize = nkeys % batchSize;
 
                 std::vector<key_type> keyBuffer(batchSize);
                 std::vector<bucket_size_type> sizeBuffer(batchSize);
+                std::vector<value_type> valueBuffer;
 
                 for(len_t b = 0; b < numFullBatches; ++b) {
                     auto batchValuesCount = deserialize_batch_of_buckets(
-                        is, keyBuffer, sizeBuffer, batchSize, valuesOffset);
+                        is, keyBuffer, sizeBuffer, valueBuffer,
+                        batchSize, valuesOffset);
 
                     indicator += batchSize*(sizeof(key_type)+sizeof(bucket_size_type))
                                + batchValuesCount*sizeof(value_type);
                     show_progress_indicator(std::cerr, float(indicator)/totalSize);
-
-                    valuesOffset += batchValuesCount;
                 }
 
                 deserialize_batch_of_buckets(
-                    is, keyBuffer, sizeBuffer, lastBatchSize, valuesOffset);
+                    is, keyBuffer, sizeBuffer, valueBuffer,
+                    lastBatchSize, valuesOffset);
             }
 
             numKeys_ = nkeys;
@@ -1087,32 +2138,351 @@ private:
 
 
     //---------------------------------------------------------------
-    iterator
-    find_occupied_slot(const key_type& key)
+    /// @brief alignment of the value array in layout-preserving files
+    static constexpr std::uint64_t layout_value_alignment() noexcept {
+        return 64;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief binary serialization of all buckets in slot order;
+     *        value lists that fit into a bucket are stored with the
+     *        bucket data; all other values are stored in one contiguous,
+     *        aligned array after the bucket data, so that it can be
+     *        memory-mapped and is only touched by lookups
+     */
+    void serialize_layout(std::ostream& os) const
     {
-        probing_iterator it {
-            buckets_.begin() + (hash_(key) % buckets_.size()),
-            buckets_.begin(), buckets_.end()};
+        using len_t = std::uint64_t;
+        using word_t = std::uint64_t;
+        constexpr len_t wordBits = 64;
 
-        //find bucket
-        do {
-            if(it->unused()) return buckets_.end();
-            if(keyEqual_(it->key(), key)) return iterator(it);
-        } while(++it);
+        const len_t inlineSize = bucket_type::inline_capacity();
 
-        return buckets_.end();
-    }
+        write_binary(os, len_t(bucket_count()));
+        write_binary(os, len_t(key_count()));
+        write_binary(os, len_t(value_count()));
+        write_binary(os, len_t(batch_size()));
+        write_binary(os, inlineSize);
 
-    //-----------------------------------------------------
-    template<class... Values>
-    iterator
-    insert_into_slot(key_type key, Values&&... newvalues)
-    {
-        probing_iterator it {
-            buckets_.begin() + (hash_(key) % buckets_.size()),
-            buckets_.begin(), buckets_.end()};
+        const len_t batchSize = batch_size();
 
+        {// write keys & bucket sizes & occupancy bits & small lists in batches
+            std::vector<key_type> keyBuffer;
+            keyBuffer.reserve(batchSize);
+            std::vector<bucket_size_type> sizeBuffer;
+            sizeBuffer.reserve(batchSize);
+            std::vector<word_t> usedBuffer;
+            usedBuffer.reserve((batchSize + wordBits - 1) / wordBits);
+            std::vector<value_type> valBuffer;
+
+            for(len_t i = 0; i < buckets_.size(); i += batchSize) {
+                const len_t last = std::min(len_t(buckets_.size()), i + batchSize);
+                usedBuffer.assign((last - i + wordBits - 1) / wordBits, 0);
+
+                for(len_t j = i; j < last; ++j) {
+                    const auto& bucket = buckets_[j];
+                    keyBuffer.emplace_back(bucket.key());
+                    //erased slots keep probing sequences intact;
+                    //they are stored as unused slots with non-zero size
+                    sizeBuffer.emplace_back(bucket.erased() ? 1 : bucket.size());
+                    if(!bucket.unused()) {
+                        usedBuffer[(j-i) / wordBits] |= word_t(1) << ((j-i) % wordBits);
+                        if(bucket.size() <= inlineSize) {
+                            valBuffer.insert(valBuffer.end(), bucket.begin(), bucket.end());
+                        }
+                    }
+                }
+                write_binary(os, keyBuffer.data(), keyBuffer.size());
+                write_binary(os, sizeBuffer.data(), sizeBuffer.size());
+                write_binary(os, usedBuffer.data(), usedBuffer.size());
+                write_binary(os, valBuffer.data(), valBuffer.size());
+                keyBuffer.clear();
+                sizeBuffer.clear();
+                valBuffer.clear();
+            }
+        }
+
+        {// pad, so that values start at an aligned file position
+            const auto pos = os.tellp();
+            const len_t align = layout_value_alignment();
+            len_t padding = 0;
+            if(pos >= 0) {
+                padding = (align - ((len_t(pos) + sizeof(len_t)) % align)) % align;
+            }
+            write_binary(os, padding);
+            for(len_t i = 0; i < padding; ++i) os.put(0);
+        }
+
+        {// write large value lists in slot order
+            std::vector<value_type> valBuffer;
+            valBuffer.reserve(batchSize);
+
+            for(const auto& bucket : buckets_) {
+                if(!bucket.unused() && bucket.size() > inlineSize) {
+                    std::copy(bucket.begin(), bucket.end(), std::back_inserter(valBuffer));
+
+                    if(valBuffer.size() >= batchSize) {
+                        write_binary(os, valBuffer.data(), valBuffer.size());
+                        valBuffer.clear();
+                    }
+                }
+            }
+            if(valBuffer.size() > 0) {
+                write_binary(os, valBuffer.data(), valBuffer.size());
+            }
+        }
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief reads buckets in slot order (no rehashing);
+     *        large value lists are memory-mapped if a file name is given
+     *        and the value allocator can adopt external memory
+     */
+    void deserialize_layout(std::istream& is, const std::string& filename)
+    {
+        using len_t = std::uint64_t;
+        using word_t = std::uint64_t;
+        constexpr len_t wordBits = 64;
+
+        clear();
+        std::cerr << '\n';
+        show_progress_indicator(std::cerr, 0);
+
+        len_t nbuckets = 0;
+        read_binary(is, nbuckets);
+        len_t nkeys = 0;
+        read_binary(is, nkeys);
+        len_t nvalues = 0;
+        read_binary(is, nvalues);
+        len_t batchSize = 0;
+        read_binary(is, batchSize);
+        //lists with at most this many values are stored with the buckets
+        len_t inlineSize = 0;
+        read_binary(is, inlineSize);
+
+        if(nbuckets < nkeys || batchSize < 1) {
+            throw std::runtime_error{"inconsistent hash table layout"};
+        }
+
+        //buckets resize might throw
+        bucket_store_t buckets;
+        buckets.resize(nbuckets);
+        std::vector<word_t> used((nbuckets + wordBits - 1) / wordBits, 0);
+
+        const auto occupied = [&](len_t i) {
+            return bool(used[i / wordBits] & (word_t(1) << (i % wordBits)));
+        };
+        const auto in_value_array = [&](len_t i) {
+            return occupied(i) && buckets[i].size_ > inlineSize;
+        };
+
+        len_t nlarge = 0;
+
+        {// read keys & bucket sizes & occupancy bits & small lists in batches
+            std::vector<key_type> keyBuffer(batchSize);
+            std::vector<bucket_size_type> sizeBuffer(batchSize);
+            std::vector<value_type> valueBuffer;
+
+            for(len_t i = 0; i < nbuckets; i += batchSize) {
+                const len_t n = std::min(nbuckets - i, batchSize);
+                read_binary(is, keyBuffer.data(), n);
+                read_binary(is, sizeBuffer.data(), n);
+                read_binary(is, used.data() + (i / wordBits),
+                            (n + wordBits - 1) / wordBits);
+
+                //buckets stay unused until their values are set
+                len_t nsmall = 0;
+                for(len_t j = 0; j < n; ++j) {
+                    auto& bucket = buckets[i+j];
+                    bucket.key_ = keyBuffer[j];
+                    bucket.size_ = sizeBuffer[j];
+                    if(occupied(i+j)) {
+                        if(bucket.size_ > inlineSize) {
+                            nlarge += bucket.size_;
+                        } else {
+                            nsmall += bucket.size_;
+                        }
+                    }
+                }
+
+                valueBuffer.resize(nsmall);
+                read_binary(is, valueBuffer.data(), nsmall);
+
+                auto vals = valueBuffer.data();
+                for(len_t j = i; j < i + n; ++j) {
+                    if(occupied(j) && !in_value_array(j)) {
+                        auto& bucket = buckets[j];
+                        const auto size = bucket.size_;
+                        if(size <= bucket_type::inline_capacity()) {
+                            bucket.insert(alloc_, vals, size, size);
+                        } else {
+                            //written with larger buckets
+                            bucket.size_ = 0;
+                            if(!bucket.insert(alloc_, vals, vals + size)) {
+                                throw std::runtime_error{
+                                    "could not allocate value list"};
+                            }
+                        }
+                        vals += size;
+                    }
+                }
+                show_progress_indicator(std::cerr, 0.5f * float(i+n) / nbuckets);
+            }
+        }
+
+        len_t padding = 0;
+        read_binary(is, padding);
+        is.ignore(padding);
+
+        value_type* values = nullptr;
+
+        //map large value lists directly from file
+        if(nlarge > 0 && !filename.empty() && alloc_adoption::supported()) {
+            const auto offset = is.tellg();
+            if(offset >= 0) {
+                auto mem = map_file_region(filename, len_t(offset),
+                                           nlarge * sizeof(value_type));
+                if(mem) {
+                    auto vals = reinterpret_cast<value_type*>(mem.get());
+                    if(alloc_adoption::adopt(alloc_,
+                        std::shared_ptr<value_type>{std::move(mem), vals}, nlarge))
+                    {
+                        values = vals;
+                        is.seekg(len_t(offset) + nlarge * sizeof(value_type));
+                    }
+                }
+            }
+        }
+
+        //dead keys (without values) must stay in probing sequences
+        if(values) {
+            //let buckets point into mapped value array;
+            //lists are only copied if written with larger buckets
+            auto valuesOffset = values;
+            for(len_t i = 0; i < nbuckets; ++i) {
+                if(in_value_array(i)) {
+                    auto& bucket = buckets[i];
+                    const auto size = bucket.size_;
+                    bucket.insert(alloc_, valuesOffset, size, size);
+                    valuesOffset += size;
+                }
+            }
+        }
+        else {
+            //read values into one large memory chunk in batches
+            reserve_values(std::max(nlarge, len_t(1)));
+            auto valuesOffset = alloc_.allocate(std::max(nlarge, len_t(1)));
+            std::vector<value_type> valueBuffer;
+
+            for(len_t i = 0; i < nbuckets; i += batchSize) {
+                const len_t last = std::min(nbuckets, i + batchSize);
+                len_t n = 0;
+                for(len_t j = i; j < last; ++j) {
+                    if(in_value_array(j)) n += buckets[j].size_;
+                }
+                valueBuffer.resize(n);
+                read_binary(is, valueBuffer.data(), n);
+
+                auto vals = valueBuffer.data();
+                for(len_t j = i; j < last; ++j) {
+                    if(in_value_array(j)) {
+                        auto& bucket = buckets[j];
+                        const auto size = bucket.size_;
+                        bucket.insert(alloc_,
+                            stash_values(vals, size, valuesOffset), size, size);
+                        vals += size;
+                    }
+                }
+            }
+        }
+        show_progress_indicator(std::cerr, 1.0f);
+
+        //restore erased slots
+        len_t nerased = 0;
+        for(len_t i = 0; i < nbuckets; ++i) {
+            auto& bucket = buckets[i];
+            if(!occupied(i) && bucket.size_ > 0) {
+                bucket.size_ = 0;
+                bucket.storage_.values = bucket_type::erased_marker();
+                ++nerased;
+            }
+        }
+
+        buckets_.swap(buckets);
+        numKeys_ = nkeys;
+        numValues_ = nvalues;
+        numErased_ = nerased;
+        batchSize_ = batchSize;
+
+        clear_current_line(std::cerr);
+    }
+
+
+    //---------------------------------------------------------------
+    iterator
+    find_occupied_slot(const key_type& key)
+    {
+        return find_occupied_slot(key, hash_(key));
+    }
+    //-----------------------------------------------------
+    template<class HashValue>
+    iterator
+    find_occupied_slot(const key_type& key, HashValue hashValue)
+    {
+        const size_type homeSlot = hashValue % buckets_.size();
+
+        if(cuckoo) {
+            return find_cuckoo_slot(key, hashValue);
+        }
+
+        probing_iterator it {
+            buckets_.begin() + homeSlot, buckets_.begin(), buckets_.end()};
+
+        //find bucket; probing continues past erased slots
         do {
+            if(it->unused()) {
+                if(!it->erased()) break;
+            }
+            else if(keyEqual_(it->key(), key)) return iterator(it);
+        } while(++it);
+
+        return rehashSource_ ? not_migrated_slot(key, hashValue)
+                             : buckets_.end();
+    }
+
+    //-----------------------------------------------------
+    /// @return slot in the table that is being migrated or end()
+    template<class HashValue>
+    iterator
+    not_migrated_slot(const key_type& key, HashValue hashValue)
+    {
+        auto it = rehashSource_->find_occupied_slot(key, hashValue);
+        return (it != rehashSource_->buckets_.end()) ? it : buckets_.end();
+    }
+
+    //-----------------------------------------------------
+    template<class... Values>
+    iterator
+    insert_into_slot(key_type key, Values&&... newvalues)
+    {
+        const auto hashValue = hash_(key);
+        const size_type homeSlot = hashValue % buckets_.size();
+
+        if(cuckoo) {
+            return insert_into_cuckoo_bin(std::move(key), hashValue,
+                                          std::forward<Values>(newvalues)...);
+        }
+
+        probing_iterator it {
+            buckets_.begin() + homeSlot, buckets_.begin(), buckets_.end()};
+
+        do {
+            //erased slots are not reused, they are reclaimed by rehashing
+            if(it->erased()) continue;
             //empty slot found
             if(it->unused()) {
                 if(it->insert(alloc_, std::forward<Values>(newvalues)...)) {
@@ -1138,20 +2508,447 @@ private:
         return buckets_.end();
     }
 
+    //---------------------------------------------------------------
+    /// @brief slot that is neither occupied nor erased
+    bool is_empty_slot(size_type slot) const noexcept {
+        return buckets_[slot].unused() && !buckets_[slot].erased();
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @return number of occupied (or erased) slots that a lookup of
+     *         an absent key with the given home slot passes before it stops
+     */
+    size_type miss_probe_length(size_type homeSlot) const
+    {
+        size_type probed = 0;
+
+        if(cuckoo) {
+            //any hash value with this primary bin
+            const auto bins = cuckoo_bins(cuckoo_bin_of_slot(homeSlot));
+            auto range = cuckoo_bin_slots(bins.first);
+            for(auto i = range.first; i < range.second; ++i) {
+                if(is_empty_slot(i)) return probed;
+                ++probed;
+            }
+            if(bins.second == bins.first) return probed;
+            range = cuckoo_bin_slots(bins.second);
+            for(auto i = range.first; i < range.second; ++i) {
+                if(is_empty_slot(i)) return probed;
+                ++probed;
+            }
+            return probed;
+        }
+
+        auto self = const_cast<hash_multimap*>(this);
+        probing_iterator it {
+            self->buckets_.begin() + homeSlot,
+            self->buckets_.begin(), self->buckets_.end()};
+        do {
+            if(it->unused() && !it->erased()) break;
+            ++probed;
+        } while(++it);
+
+        return probed;
+    }
+
+    //---------------------------------------------------------------
+    size_type cuckoo_bin_count() const noexcept {
+        return std::max(size_type(1), size_type(buckets_.size() / cuckoo_bin_size));
+    }
+    //-----------------------------------------------------
+    size_type cuckoo_bin_of_slot(size_type slot) const noexcept {
+        return std::min(slot / cuckoo_bin_size, cuckoo_bin_count() - 1);
+    }
+    //-----------------------------------------------------
+    /// @brief slot range of a bin; the last bin also gets remaining slots
+    std::pair<size_type,size_type>
+    cuckoo_bin_slots(size_type bin) const noexcept {
+        const size_type first = bin * cuckoo_bin_size;
+        return {first, (bin + 1 < cuckoo_bin_count())
+                       ? first + cuckoo_bin_size : buckets_.size()};
+    }
+    //-----------------------------------------------------
+    /// @return {primary bin, alternative bin}
+    template<class HashValue>
+    std::pair<size_type,size_type>
+    cuckoo_bins(HashValue hashValue) const noexcept {
+        const size_type nbins = cuckoo_bin_count();
+        const size_type primary = hashValue % nbins;
+        if(nbins < 2) return {primary, primary};
+
+        //remix, so that both bins are (nearly) independent
+        std::uint64_t x = std::uint64_t(hashValue) * 0x9e3779b97f4a7c15ULL;
+        x ^= x >> 31;
+        auto alt = size_type(x % (nbins - 1));
+        if(alt >= primary) ++alt;
+        return {primary, alt};
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief  occupied slots of a bin always form a prefix of it
+     * @return slot with key or end(); 'free' is set to the first empty slot
+     */
+    iterator
+    scan_cuckoo_bin(const key_type& key, size_type bin, iterator& free)
+    {
+        const auto range = cuckoo_bin_slots(bin);
+        for(auto i = range.first; i < range.second; ++i) {
+            const auto& b = buckets_[i];
+            if(b.unused()) {
+                if(!b.erased()) {
+                    free = buckets_.begin() + i;
+                    break;
+                }
+            }
+            else if(keyEqual_(b.key(), key)) {
+                return buckets_.begin() + i;
+            }
+        }
+        return buckets_.end();
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @details Bins never get empty slots again once they are full, so
+     *          a key can only be in its alternative bin, if its primary
+     *          bin is full.
+     */
+    template<class HashValue>
+    iterator
+    find_cuckoo_slot(const key_type& key, HashValue hashValue)
+    {
+        const auto bins = cuckoo_bins(hashValue);
+        auto free = buckets_.end();
+        auto it = scan_cuckoo_bin(key, bins.first, free);
+        if(it != buckets_.end() || free != buckets_.end() ||
+           bins.second == bins.first)
+        {
+            return it;
+        }
+        return scan_cuckoo_bin(key, bins.second, free);
+    }
+
+    //-----------------------------------------------------
+    template<class HashValue, class... Values>
+    iterator
+    insert_into_cuckoo_bin(key_type key, HashValue hashValue,
+                           Values&&... newvalues)
+    {
+        const auto bins = cuckoo_bins(hashValue);
+        auto free = buckets_.end();
+        auto it = scan_cuckoo_bin(key, bins.first, free);
+        if(it == buckets_.end() && free == buckets_.end() &&
+           bins.second != bins.first)
+        {
+            it = scan_cuckoo_bin(key, bins.second, free);
+        }
+        //key already inserted
+        if(it != buckets_.end()) {
+            auto oldsize = it->size();
+            if(it->insert(alloc_, std::forward<Values>(newvalues)...)) {
+                numValues_ += it->size() - oldsize;
+                return it;
+            }
+            return buckets_.end();
+        }
+        //bins must not get an empty slot, if insertion fails
+        bucket_type b{std::move(key)};
+        if(!b.insert(alloc_, std::forward<Values>(newvalues)...)) {
+            return buckets_.end();
+        }
+        if(free == buckets_.end()) free = make_cuckoo_room(bins);
+
+        if(free == buckets_.end()) {
+            //no cuckoo path found => grow table and try again
+            rehash(grown_bucket_count(buckets_.size()));
+            auto k = b.key();
+            return insert_into_slot(std::move(k), std::move(b));
+        }
+        *free = std::move(b);
+        ++numKeys_;
+        numValues_ += free->size();
+        return free;
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief  breadth-first search for the shortest sequence of moves of
+     *         buckets into their alternative bins that frees a slot
+     *         in one of the given bins
+     * @return freed slot or end(), if no such sequence was found
+     */
+    iterator
+    make_cuckoo_room(std::pair<size_type,size_type> bins)
+    {
+        struct node { size_type slot; int parent; };
+        constexpr int max_nodes = 256;
+        node nodes[max_nodes];
+        size_type visited[max_nodes];
+        int numNodes = 0;
+        int numVisited = 0;
+
+        auto expand = [&] (size_type bin, int parent) {
+            if(numVisited >= max_nodes) return;
+            for(int i = 0; i < numVisited; ++i) {
+                if(visited[i] == bin) return;
+            }
+            visited[numVisited++] = bin;
+            const auto range = cuckoo_bin_slots(bin);
+            for(auto i = range.first; i < range.second; ++i) {
+                if(numNodes >= max_nodes) return;
+                //erased slots are never moved
+                if(!buckets_[i].unused()) nodes[numNodes++] = node{i, parent};
+            }
+        };
+
+        expand(bins.first, -1);
+        if(bins.second != bins.first) expand(bins.second, -1);
+
+        for(int i = 0; i < numNodes; ++i) {
+            const auto slot = nodes[i].slot;
+            const auto bin = cuckoo_bin_of_slot(slot);
+            const auto own = cuckoo_bins(hash_(buckets_[slot].key()));
+            const auto target = (own.first == bin) ? own.second : own.first;
+            if(target == bin) continue;
+
+            auto free = buckets_.end();
+            scan_cuckoo_bin(buckets_[slot].key(), target, free);
+
+            if(free != buckets_.end()) {
+                //move buckets along the path, starting with the last one
+                for(int j = i; j >= 0; j = nodes[j].parent) {
+                    auto src = buckets_.begin() + nodes[j].slot;
+                    *free = std::move(*src);
+                    free = src;
+                }
+                *free = bucket_type{};
+                return free;
+            }
+            expand(target, i);
+        }
+        return buckets_.end();
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief  finds the bucket with the given key or the first unused slot
+     *         in the key's probing sequence starting at 'homeSlot'
+     * @return end(), if the probing sequence leaves slot range [first,last)
+     *         before a matching or unused slot could be found
+     */
+    iterator
+    find_slot_in_range(const key_type& key, size_type homeSlot,
+                       size_type first, size_type last)
+    {
+        probing_iterator it {
+            buckets_.begin() + homeSlot, buckets_.begin(), buckets_.end()};
+
+        do {
+            const auto slot = size_type(iterator(it) - buckets_.begin());
+            if(slot < first || slot >= last) break;
+
+            if(it->unused()) {
+                if(!it->erased()) return iterator(it);
+            }
+            else if(keyEqual_(it->key(), key)) return iterator(it);
+        } while(++it);
+
+        return buckets_.end();
+    }
+
+
     //---------------------------------------------------------------
     void make_sure_enough_buckets_left(size_type more)
     {
-        auto n = numKeys_ + more;
+        //erased slots still occupy their buckets until the next rehash
+        const auto used = numKeys_ + numErased_ + more;
 
-        if( (n / float(buckets_.size()) > maxLoadFactor_ ) ||
-            (n >= buckets_.size()) )
+        if( (used / float(buckets_.size()) > maxLoadFactor_ ) ||
+            (used >= buckets_.size()) )
         {
-            rehash(std::max(
-                size_type(1 + 1.8 * n),
-                size_type(1 + 1.8 * (n / maxLoadFactor_)) ));
+            const auto n = numKeys_ + more;
+            auto nb = std::max(size_type(1 + 1.8 * n),
+                               size_type(1 + 1.8 * (n / maxLoadFactor_)) );
+            if(nb == buckets_.size()) ++nb;
+            if(incrementalRehash_) {
+                start_incremental_rehash(nb);
+            } else {
+                rehash(nb);
+            }
+        }
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief makes room for one more key; during an incremental rehash
+     *        'key' is moved to the current table (if it exists) and
+     *        some more buckets are migrated
+     */
+    void prepare_insertion(const key_type& key)
+    {
+        make_sure_enough_buckets_left(1);
+        if(rehashSource_) {
+            migrate_key(key);
+            migrate_buckets(rehash_step());
         }
     }
 
+    //-----------------------------------------------------
+    /**
+     * @brief replaces the table with an empty one with 'n' slots;
+     *        the old table is kept until all its buckets are migrated
+     */
+    void start_incremental_rehash(size_type n)
+    {
+        complete_rehash();
+
+        rehashSource_.reset(new hash_multimap{size_type(0)});
+        auto& src = *rehashSource_;
+        src.hash_ = hash_;
+        src.keyEqual_ = keyEqual_;
+        src.buckets_.swap(buckets_);
+        rehashPos_ = 0;
+
+        buckets_.resize(n);
+        //erased slots are left behind in the old table
+        numErased_ = 0;
+    }
+
+    //-----------------------------------------------------
+    /// @brief migrates the next 'n' slots of the old table
+    void migrate_buckets(size_type n)
+    {
+        const auto numSlots = rehashSource_->buckets_.size();
+        const auto last = std::min(numSlots, rehashPos_ + n);
+        for(; rehashPos_ < last; ++rehashPos_) {
+            migrate_bucket(rehashPos_);
+        }
+        if(rehashPos_ >= numSlots) rehashSource_ = nullptr;
+    }
+
+    //-----------------------------------------------------
+    void migrate_key(const key_type& key)
+    {
+        auto& src = *rehashSource_;
+        auto it = src.find_occupied_slot(key);
+        if(it != src.buckets_.end()) {
+            migrate_bucket(size_type(it - src.buckets_.begin()));
+        }
+    }
+
+    //-----------------------------------------------------
+    /// @brief number of values that are not stored inside buckets
+    size_type out_of_line_value_count() const noexcept
+    {
+        size_type n = 0;
+        for(const auto& b : buckets_) {
+            if(b.size() > bucket_type::inline_capacity()) n += b.size();
+        }
+        if(rehashSource_) n += rehashSource_->out_of_line_value_count();
+        return n;
+    }
+
+    //-----------------------------------------------------
+    /// @brief inserts a copy of a bucket from another table
+    void copy_bucket(const bucket_type& b)
+    {
+        make_sure_enough_buckets_left(1);
+        while(insert_into_slot(b.key(), b.begin(), b.end()) == buckets_.end()) {
+            //probing sequence exhausted
+            rehash_buckets(grown_bucket_count(buckets_.size()));
+        }
+    }
+
+    //-----------------------------------------------------
+    void migrate_bucket(size_type slot)
+    {
+        auto& src = *rehashSource_;
+        auto& b = src.buckets_[slot];
+        if(b.unused()) return;
+
+        //bucket is counted again by the current table
+        --numKeys_;
+        numValues_ -= b.size();
+        //a failed insertion leaves 'b' untouched
+        while(insert_into_slot(b.key_, std::move(b)) == buckets_.end()) {
+            //probing sequence exhausted => grow the current table only
+            rehash_buckets(grown_bucket_count(buckets_.size()));
+        }
+
+        //keeps probing sequences of other keys in the old table intact
+        b.storage_.values = bucket_type::erased_marker();
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief drops the old table of an incremental rehash;
+     *        the values of buckets that were not yet migrated
+     *        belong to this map's allocator
+     */
+    void discard_rehash_source(bool deallocate = true)
+    {
+        if(!rehashSource_) return;
+        for(auto& b : rehashSource_->buckets_) {
+            if(deallocate) b.deallocate(alloc_);
+            b.storage_.values = typename bucket_type::value_ref{};
+            b.size_ = 0;
+            b.capacity_ = 0;
+        }
+        rehashSource_ = nullptr;
+    }
+
+    //-----------------------------------------------------
+    /// @return true, if 'it' refers to a slot of the current table
+    bool owns(const_iterator it) const noexcept {
+        const auto p = &(*it);
+        return !std::less<const bucket_type*>{}(p, buckets_.data()) &&
+                std::less<const bucket_type*>{}(p, buckets_.data() + buckets_.size());
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief moves all buckets of the current table into a new table
+     *        with (at least) 'n' slots; the new table grows further, if
+     *        some key's probing sequence has no free slot left
+     *        (possible at very high load factors)
+     */
+    void rehash_buckets(size_type n)
+    {
+        //make temporary new map
+        //buckets resize might throw
+        hash_multimap newmap{n};
+        newmap.maxLoadFactor_ = maxLoadFactor_;
+        newmap.hash_ = hash_;
+        newmap.keyEqual_ = keyEqual_;
+
+        //move old bucket contents into new hash slots
+        //a failed insertion leaves the source bucket untouched
+        for(auto& b : buckets_) {
+            if(!b.unused()) {
+                while(newmap.insert_into_slot(b.key_, std::move(b)) ==
+                      newmap.buckets_.end())
+                {
+                    newmap.rehash_buckets(grown_bucket_count(newmap.bucket_count()));
+                }
+            }
+        }
+
+        //should all be noexcept
+        buckets_ = std::move(newmap.buckets_);
+        hash_ = std::move(newmap.hash_);
+        numErased_ = 0;
+    }
+
+    //-----------------------------------------------------
+    static size_type grown_bucket_count(size_type n) noexcept {
+        return size_type(1 + 1.5 * n);
+    }
+
 
     //---------------------------------------------------------------
     bool rehash_possible(size_type n) const noexcept
@@ -1169,12 +2966,18 @@ private:
     //---------------------------------------------------------------
     size_type numKeys_;
     size_type numValues_;
+    size_type numErased_;
     size_type batchSize_;
     float maxLoadFactor_;
     hasher hash_;
     key_equal keyEqual_;
     value_allocator alloc_;
     bucket_store_t buckets_;
+    //old table during an incremental rehash; its buckets are migrated
+    //in slot order, all slots before 'rehashPos_' are already migrated
+    std::unique_ptr<hash_multimap> rehashSource_;
+    size_type rehashPos_;
+    bool incrementalRehash_;
 };
 
 
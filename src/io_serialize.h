@@ -56,9 +56,9 @@ write_binary(std::ostream& os, const std::basic_string<CharT>& str)
 
 
 //-------------------------------------------------------------------
-template<class T>
+template<class T, class A>
 inline void
-write_binary(std::ostream& os, const std::vector<T>& v)
+write_binary(std::ostream& os, const std::vector<T,A>& v)
 {
     std::uint64_t n = v.size();
     os.write(reinterpret_cast<const char*>(&n), sizeof(n));
@@ -119,9 +119,9 @@ read_binary(std::istream& is, std::basic_string<CharT>& str)
 
 
 //-------------------------------------------------------------------
-template<class T>
+template<class T, class A>
 inline void
-read_binary(std::istream& is, std::vector<T>& v)
+read_binary(std::istream& is, std::vector<T,A>& v)
 {
 
     std::uint64_t n = 0;
@@ -0,0 +1,274 @@
+/******************************************************************************
+ *
+ * MetaCache - Meta-Genomic Classification Tool
+ *
+ * Copyright (C) 2016-2020 André Müller (muellan@uni-mainz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef _WIN32
+    #include <unistd.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+    #include <sys/syscall.h>
+#endif
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "memory_policy.h"
+
+
+namespace mc {
+
+
+//-------------------------------------------------------------------
+namespace {
+
+memory_policy currentPolicy_;
+
+/// @brief mappings are always multiples of this, regardless of policy,
+///        so that they can be unmapped even if the policy changed
+constexpr std::size_t huge_page_size() noexcept { return std::size_t(2) << 20; }
+
+std::size_t mapping_size(std::size_t bytes) noexcept {
+    return ((bytes + huge_page_size() - 1) / huge_page_size()) * huge_page_size();
+}
+
+
+//-------------------------------------------------------------------
+/// @brief parses kernel id lists like "0-3,8-11"
+std::vector<unsigned> read_id_list(const std::string& filename)
+{
+    std::vector<unsigned> ids;
+    std::ifstream is {filename};
+    unsigned first = 0;
+    while(is >> first) {
+        unsigned last = first;
+        if(is.peek() == '-') {
+            is.ignore(1);
+            is >> last;
+        }
+        for(auto i = first; i <= last; ++i) ids.push_back(i);
+        is.ignore(1);
+    }
+    return ids;
+}
+
+
+#if !defined(_WIN32) && defined(SYS_mbind)
+//-------------------------------------------------------------------
+/// @brief kernel NUMA memory policy; no libnuma needed
+void apply_numa_policy(void* mem, std::size_t bytes, const memory_policy& policy)
+{
+    //constants from <numaif.h>
+    constexpr int mpol_preferred  = 1;
+    constexpr int mpol_interleave = 3;
+    constexpr std::size_t maskBits = 8 * sizeof(unsigned long);
+
+    std::vector<unsigned long> mask;
+    int mode = mpol_preferred;
+
+    if(policy.numa == numa_policy::interleave) {
+        //node ids of online nodes need not be contiguous
+        const auto nodes = read_id_list("/sys/devices/system/node/online");
+        //nothing to interleave
+        if(nodes.size() < 2) return;
+        mask.resize(nodes.back() / maskBits + 1, 0);
+        for(auto i : nodes) {
+            mask[i / maskBits] |= 1ul << (i % maskBits);
+        }
+        mode = mpol_interleave;
+    }
+    else {
+        mask.resize(policy.node / maskBits + 1, 0);
+        mask[policy.node / maskBits] |= 1ul << (policy.node % maskBits);
+    }
+    //failure (e.g. kernel without NUMA support) only affects placement
+    syscall(SYS_mbind, mem, bytes, mode, mask.data(),
+            mask.size() * maskBits + 1, 0);
+}
+#else
+void apply_numa_policy(void*, std::size_t, const memory_policy&) {}
+#endif
+
+} // namespace
+
+
+
+//-------------------------------------------------------------------
+#ifdef __linux__
+std::vector<unsigned> usable_numa_nodes()
+{
+    cpu_set_t allowed;
+    const bool restricted = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+    std::vector<unsigned> nodes;
+    for(auto node : read_id_list("/sys/devices/system/node/online")) {
+        //memory-only nodes have an empty cpu list
+        const auto cpus = read_id_list("/sys/devices/system/node/node"
+                                       + std::to_string(node) + "/cpulist");
+        if(std::any_of(cpus.begin(), cpus.end(), [&](unsigned cpu) {
+            return cpu < CPU_SETSIZE && (!restricted || CPU_ISSET(cpu, &allowed));
+        })) {
+            nodes.push_back(node);
+        }
+    }
+    if(nodes.empty()) nodes.push_back(0);
+    return nodes;
+}
+#else
+std::vector<unsigned> usable_numa_nodes()
+{
+    return {0};
+}
+#endif
+
+
+
+//-------------------------------------------------------------------
+#ifdef __linux__
+numa_node_binding::numa_node_binding(unsigned node):
+    oldMask_{}
+{
+    const auto cpus = read_id_list("/sys/devices/system/node/node"
+                                   + std::to_string(node) + "/cpulist");
+    if(cpus.empty()) return;
+
+    cpu_set_t old;
+    if(sched_getaffinity(0, sizeof(old), &old) != 0) return;
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    for(auto cpu : cpus) {
+        if(cpu < CPU_SETSIZE) CPU_SET(cpu, &mask);
+    }
+    if(sched_setaffinity(0, sizeof(mask), &mask) != 0) return;
+
+    const auto p = reinterpret_cast<const char*>(&old);
+    oldMask_.assign(p, p + sizeof(old));
+}
+
+//-----------------------------------------------------
+numa_node_binding::~numa_node_binding()
+{
+    if(bound()) {
+        sched_setaffinity(0, oldMask_.size(),
+                          reinterpret_cast<const cpu_set_t*>(oldMask_.data()));
+    }
+}
+#else
+numa_node_binding::numa_node_binding(unsigned): oldMask_{} {}
+numa_node_binding::~numa_node_binding() {}
+#endif
+
+
+
+//-------------------------------------------------------------------
+void set_memory_policy(const memory_policy& policy)
+{
+    currentPolicy_ = policy;
+}
+
+//-------------------------------------------------------------------
+const memory_policy& current_memory_policy() noexcept
+{
+    return currentPolicy_;
+}
+
+
+
+//-------------------------------------------------------------------
+std::string to_string(const memory_policy& policy)
+{
+    std::string s;
+    switch(policy.pages) {
+        default:
+        case page_policy::standard:         s = "standard pages"; break;
+        case page_policy::transparent_huge: s = "transparent huge pages"; break;
+        case page_policy::explicit_huge:    s = "explicit huge pages"; break;
+    }
+    switch(policy.numa) {
+        default:
+        case numa_policy::none: break;
+        case numa_policy::interleave: s += ", NUMA interleave"; break;
+        case numa_policy::node:
+            s += ", NUMA node " + std::to_string(policy.node); break;
+    }
+    return s;
+}
+
+
+
+//-------------------------------------------------------------------
+void* allocate_pages(std::size_t bytes) noexcept
+{
+#ifdef _WIN32
+    auto p = ::operator new(bytes, std::nothrow);
+    if(p) std::memset(p, 0, bytes);
+    return p;
+#else
+    if(bytes < 1) return nullptr;
+
+    const auto& policy = currentPolicy_;
+    const auto size = mapping_size(bytes);
+    void* mem = MAP_FAILED;
+
+    #ifdef MAP_HUGETLB
+    if(policy.pages == page_policy::explicit_huge) {
+        //fails if not enough huge pages are reserved
+        constexpr int map_huge_2mb = 21 << 26;
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | map_huge_2mb,
+                   -1, 0);
+    }
+    #endif
+    if(mem == MAP_FAILED) {
+        mem = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(mem == MAP_FAILED) return nullptr;
+
+        #ifdef MADV_HUGEPAGE
+        if(policy.pages != page_policy::standard) {
+            madvise(mem, size, MADV_HUGEPAGE);
+        }
+        #endif
+    }
+
+    if(policy.numa != numa_policy::none) {
+        apply_numa_policy(mem, size, policy);
+    }
+    return mem;
+#endif
+}
+
+
+
+//-------------------------------------------------------------------
+void deallocate_pages(void* p, std::size_t bytes) noexcept
+{
+    if(!p) return;
+#ifdef _WIN32
+    ::operator delete(p);
+#else
+    munmap(p, mapping_size(bytes));
+#endif
+}
+
+
+} // namespace mc
@@ -0,0 +1,234 @@
+/******************************************************************************
+ *
+ * MetaCache - Meta-Genomic Classification Tool
+ *
+ * Copyright (C) 2016-2020 André Müller (muellan@uni-mainz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef MC_MEMORY_POLICY_H_
+#define MC_MEMORY_POLICY_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <new>
+#include <string>
+#include <vector>
+
+
+namespace mc {
+
+
+/*************************************************************************//**
+ *
+ * @brief page size used for large tables (bucket arrays, location lists)
+ *        standard:         regular pages
+ *        transparent_huge: kernel may back memory with huge pages (THP)
+ *        explicit_huge:    pre-reserved huge pages (hugetlbfs);
+ *                          falls back to transparent huge pages
+ *
+ *****************************************************************************/
+enum class page_policy : std::uint8_t {
+    standard, transparent_huge, explicit_huge
+};
+
+
+/*************************************************************************//**
+ *
+ * @brief NUMA placement of large tables
+ *        none:       first-touch placement (OS default)
+ *        interleave: pages are spread round-robin over all nodes
+ *        node:       pages are preferably placed on one node
+ *
+ *****************************************************************************/
+enum class numa_policy : std::uint8_t {
+    none, interleave, node
+};
+
+
+
+/*************************************************************************//**
+ *
+ * @brief how large tables are placed in memory
+ *
+ *****************************************************************************/
+struct memory_policy
+{
+    page_policy pages = page_policy::standard;
+    numa_policy numa  = numa_policy::none;
+    std::uint16_t node = 0;
+
+    friend bool
+    operator == (const memory_policy& a, const memory_policy& b) noexcept {
+        return a.pages == b.pages && a.numa == b.numa &&
+               (a.numa != numa_policy::node || a.node == b.node);
+    }
+    friend bool
+    operator != (const memory_policy& a, const memory_policy& b) noexcept {
+        return !(a == b);
+    }
+};
+
+
+//-------------------------------------------------------------------
+std::string to_string(const memory_policy&);
+
+
+
+/*************************************************************************//**
+ *
+ * @brief sets policy for all subsequent large allocations;
+ *        memory that was already allocated is not affected
+ *
+ *****************************************************************************/
+void set_memory_policy(const memory_policy&);
+
+const memory_policy& current_memory_policy() noexcept;
+
+
+
+/*************************************************************************//**
+ *
+ * @brief allocations of at least this many bytes are backed by
+ *        anonymous memory mappings that follow the current memory policy
+ *
+ *****************************************************************************/
+constexpr std::size_t min_large_allocation_size() noexcept {
+    return std::size_t(8) << 20;
+}
+
+
+/*************************************************************************//**
+ *
+ * @brief allocates zero-initialized memory that follows the current policy
+ * @details POSIX only; uses ::operator new on other platforms
+ *
+ * @return nullptr if allocation failed
+ *
+ *****************************************************************************/
+void* allocate_pages(std::size_t bytes) noexcept;
+
+void deallocate_pages(void*, std::size_t bytes) noexcept;
+
+
+
+/*************************************************************************//**
+ *
+ * @brief hint to load a cache line that will be read soon
+ *
+ *****************************************************************************/
+inline void prefetch(const void* p) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(p);
+#else
+    (void)p;
+#endif
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief online NUMA nodes with CPUs that the process is allowed to run on
+ *        (in ascending order); {0} if unknown
+ *
+ *****************************************************************************/
+std::vector<unsigned> usable_numa_nodes();
+
+
+
+/*************************************************************************//**
+ *
+ * @brief binds the calling thread to the CPUs of one NUMA node;
+ *        the previous CPU affinity is restored on destruction
+ * @details Linux only; has no effect on other platforms
+ *
+ *****************************************************************************/
+class numa_node_binding
+{
+public:
+    explicit
+    numa_node_binding(unsigned node);
+
+    numa_node_binding(const numa_node_binding&) = delete;
+    numa_node_binding& operator = (const numa_node_binding&) = delete;
+
+    ~numa_node_binding();
+
+    bool bound() const noexcept { return !oldMask_.empty(); }
+
+private:
+    std::vector<char> oldMask_;
+};
+
+
+
+/*************************************************************************//**
+ *
+ * @brief standard-conforming allocator for large arrays
+ *        (e.g. hash table bucket arrays);
+ *        small allocations use ::operator new
+ *
+ *****************************************************************************/
+template<class T>
+class page_allocator
+{
+public:
+    using value_type = T;
+
+    page_allocator() noexcept = default;
+
+    template<class U>
+    page_allocator(const page_allocator<U>&) noexcept {}
+
+    T* allocate(std::size_t n) {
+        const auto bytes = n * sizeof(T);
+        if(bytes < min_large_allocation_size()) {
+            return static_cast<T*>(::operator new(bytes));
+        }
+        auto p = allocate_pages(bytes);
+        if(!p) throw std::bad_alloc{};
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        const auto bytes = n * sizeof(T);
+        if(bytes < min_large_allocation_size()) {
+            ::operator delete(p);
+        } else {
+            deallocate_pages(p, bytes);
+        }
+    }
+};
+
+//-------------------------------------------------------------------
+template<class T, class U>
+bool operator == (const page_allocator<T>&, const page_allocator<U>&) noexcept {
+    return true;
+}
+
+//-------------------------------------------------------------------
+template<class T, class U>
+bool operator != (const page_allocator<T>&, const page_allocator<U>&) noexcept {
+    return false;
+}
+
+
+} // namespace mc
+
+
+#endif
@@ -31,6 +31,8 @@
 #include <vector>
 
 #include <thread>
+#include <atomic>
+#include <future>
 #include <chrono>
 
 #include "timer.h"
@@ -40,8 +42,10 @@
 #include "io_error.h"
 #include "io_options.h"
 #include "database.h"
+#include "hash_int.h"
 #include "printing.h"
 #include "sequence_io.h"
+#include "stat_cardinality.h"
 #include "taxonomy_io.h"
 
 #include "batch_processing.h"
@@ -249,6 +253,35 @@ using input_batch = std::vector<input_sequence>;
 
 
 
+/*************************************************************************//**
+ *
+ * @brief calls 'sketch(i)' for all i in [0,n) with at most 'numThreads'
+ *        threads (including the calling thread)
+ *
+ *****************************************************************************/
+template<class Sketcher>
+void sketch_concurrently(std::size_t n, int numThreads, Sketcher&& sketch)
+{
+    if(n < 1) return;
+
+    std::atomic<std::size_t> next{0};
+
+    const auto sketchAll = [&] {
+        for(auto i = next++; i < n; i = next++) sketch(i);
+    };
+
+    const auto numWorkers = std::min(std::size_t(std::max(1, numThreads)), n) - 1;
+    std::vector<std::future<void>> workers;
+    workers.reserve(numWorkers);
+    for(std::size_t w = 0; w < numWorkers; ++w) {
+        workers.push_back(std::async(std::launch::async, sketchAll));
+    }
+    sketchAll();
+    for(auto& w : workers) w.get();
+}
+
+
+
 /*************************************************************************//**
  *
  * @brief add batch of reference targets to database
@@ -260,37 +293,79 @@ void add_targets_to_database(
     database& db,
     const input_batch& batch,
     const std::map<string,taxon_id>& sequ2taxid,
+    int numThreads,
     info_level infoLvl = info_level::moderate)
 {
-    for(const auto& seq : batch) {
-        if(!seq.data.empty()) {
-            auto seqId = extract_accession_string(
-                             seq.header, sequence_id_type::any);
-
-            // make sure sequence id is not empty,
-            // use entire header if neccessary
-            if(seqId.empty()) seqId = seq.header;
+    struct target_info {
+        string seqId;
+        taxon_id parentTaxId = 0;
+        bool accepted = false;
+    };
+
+    // determine ids first, so that sequences that would be rejected
+    // (empty or non-unique id) are not sketched
+    std::vector<target_info> infos(batch.size());
+    std::set<string> batchIds;
+    for(std::size_t i = 0; i < batch.size(); ++i) {
+        const auto& seq = batch[i];
+        if(seq.data.empty()) continue;
+
+        auto& info = infos[i];
+        info.seqId = extract_accession_string(
+                         seq.header, sequence_id_type::any);
+
+        // make sure sequence id is not empty,
+        // use entire header if neccessary
+        if(info.seqId.empty()) info.seqId = seq.header;
+
+        info.parentTaxId = seq.fileTaxId;
+
+        if(info.parentTaxId == taxonomy::none_id())
+            info.parentTaxId = find_taxon_id(sequ2taxid, info.seqId);
+
+        if(info.parentTaxId == taxonomy::none_id())
+            info.parentTaxId = extract_taxon_id(seq.header);
+
+        info.accepted = !db.taxon_with_name(info.seqId) &&
+                        batchIds.insert(info.seqId).second;
+    }
 
-            taxon_id parentTaxId = seq.fileTaxId;
+    // sketch sequences concurrently;
+    // targets are still added in input order (=> deterministic target ids)
+    std::vector<std::vector<database::sketch>> sketches;
+    if(numThreads > 1 && batch.size() > 1) {
+        sketches.resize(batch.size());
+        sketch_concurrently(batch.size(), numThreads, [&] (std::size_t i) {
+            if(infos[i].accepted) {
+                sketches[i] = db.target_sketches(batch[i].data);
+            }
+        });
+    }
 
-            if(parentTaxId == taxonomy::none_id())
-                parentTaxId = find_taxon_id(sequ2taxid, seqId);
+    for(std::size_t i = 0; i < batch.size(); ++i) {
+        const auto& seq = batch[i];
 
-            if(parentTaxId == taxonomy::none_id())
-                parentTaxId = extract_taxon_id(seq.header);
+        if(!seq.data.empty()) {
+            const auto& info = infos[i];
 
             if(infoLvl == info_level::verbose) {
-                cout << "[" << seqId;
-                if(parentTaxId > 0) cout << ":" << parentTaxId;
+                cout << "[" << info.seqId;
+                if(info.parentTaxId > 0) cout << ":" << info.parentTaxId;
                 cout << "] ";
             }
 
             // try to add to database
-            bool added = db.add_target(
-                seq.data, seqId, parentTaxId, seq.fileSource);
+            bool added = false;
+            if(info.accepted) {
+                added = sketches.empty()
+                    ? db.add_target(seq.data, info.seqId,
+                                    info.parentTaxId, seq.fileSource)
+                    : db.add_target(std::move(sketches[i]), info.seqId,
+                                    info.parentTaxId, seq.fileSource);
+            }
 
             if(infoLvl == info_level::verbose && !added) {
-                cout << seqId << " not added to database" << endl;
+                cout << info.seqId << " not added to database" << endl;
             }
         }
         if(db.add_target_failed()) break;
@@ -301,21 +376,72 @@ void add_targets_to_database(
 
 /*************************************************************************//**
  *
- * @brief adds reference sequences from *several* files to database
+ * @brief reads sequences from several files into batches of an executor
  *
  *****************************************************************************/
-void add_targets_to_database(database& db,
+void read_reference_sequences(batch_executor<input_sequence>& executor,
     const std::vector<string>& infiles,
     const std::map<string,taxon_id>& sequ2taxid,
-    info_level infoLvl = info_level::moderate)
+    info_level infoLvl)
 {
     int n = infiles.size();
     int i = 0;
 
+    for(const auto& filename : infiles) {
+        if(infoLvl == info_level::verbose) {
+            cout << "  " << filename << " ... " << flush;
+        } else if(infoLvl != info_level::silent) {
+            show_progress_indicator(cout, i/float(n));
+        }
+
+        try {
+            const auto fileId = extract_accession_string(
+                                    filename, sequence_id_type::acc_ver);
+
+            const taxon_id fileTaxId = find_taxon_id(sequ2taxid, fileId);
+
+            auto reader = make_sequence_reader(filename);
+
+            while(reader->has_next() && executor.valid()) {
+                // get (ref to) next input sequence storage and fill it
+                auto& seq = executor.next_item();
+                seq.fileSource.filename = filename;
+                seq.fileSource.index = reader->index();
+                seq.fileTaxId = fileTaxId;
+                reader->next_header_and_data(seq.header, seq.data);
+            }
+
+            if(infoLvl == info_level::verbose) {
+                cout << "done." << endl;
+            }
+        }
+        catch(std::exception& e) {
+            if(infoLvl == info_level::verbose) {
+                cout << "FAIL: " << e.what() << endl;
+            }
+        }
+        ++i;
+    }
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief adds reference sequences from *several* files to database
+ *
+ *****************************************************************************/
+void add_targets_to_database(database& db,
+    const std::vector<string>& infiles,
+    const std::map<string,taxon_id>& sequ2taxid,
+    int numThreads,
+    info_level infoLvl = info_level::moderate)
+{
     // make executor that runs database insertion (concurrently) in batches
     // IMPORTANT: do not use more than one worker thread!
+    //            (each batch is sketched by up to 'numThreads' threads)
     batch_processing_options execOpt;
-    execOpt.batch_size(8);
+    execOpt.batch_size(std::max(8, numThreads));
     execOpt.queue_size(4);
     execOpt.concurrency(1);
 
@@ -338,45 +464,106 @@ void add_targets_to_database(database& db,
 
     batch_executor<input_sequence> executor { execOpt,
         [&] (int, const auto& batch) {
-            add_targets_to_database(db, batch, sequ2taxid, infoLvl);
+            add_targets_to_database(db, batch, sequ2taxid, numThreads, infoLvl);
         }};
 
     // read sequences in main thread
-    for(const auto& filename : infiles) {
-        if(infoLvl == info_level::verbose) {
-            cout << "  " << filename << " ... " << flush;
-        } else if(infoLvl != info_level::silent) {
-            show_progress_indicator(cout, i/float(n));
-        }
+    read_reference_sequences(executor, infiles, sequ2taxid, infoLvl);
+}
 
-        try {
-            const auto fileId = extract_accession_string(
-                                    filename, sequence_id_type::acc_ver);
 
-            const taxon_id fileTaxId = find_taxon_id(sequ2taxid, fileId);
 
-            auto reader = make_sequence_reader(filename);
+/*************************************************************************//**
+ *
+ * @brief sketches all reference sequences (without adding them to the
+ *        database) and calls 'consume(window sketches)' for each of them
+ *        in input order
+ *
+ *****************************************************************************/
+template<class Consumer>
+void sketch_reference_sequences(const database& db,
+    const std::vector<string>& infiles,
+    int numThreads,
+    info_level infoLvl,
+    Consumer&& consume)
+{
+    // consumers are not thread-safe => only one worker thread
+    batch_processing_options execOpt;
+    execOpt.batch_size(std::max(8, numThreads));
+    execOpt.queue_size(4);
+    execOpt.concurrency(1);
 
-            while(reader->has_next() && executor.valid()) {
-                // get (ref to) next input sequence storage and fill it
-                auto& seq = executor.next_item();
-                seq.fileSource.filename = filename;
-                seq.fileSource.index = reader->index();
-                seq.fileTaxId = fileTaxId;
-                reader->next_header_and_data(seq.header, seq.data);
+    batch_executor<input_sequence> executor { execOpt,
+        [&] (int, const input_batch& batch) {
+            std::vector<std::vector<database::sketch>> sketches(batch.size());
+            sketch_concurrently(batch.size(), numThreads, [&] (std::size_t i) {
+                sketches[i] = db.target_sketches(batch[i].data);
+            });
+            for(const auto& sk : sketches) {
+                consume(sk);
             }
+        }};
 
-            if(infoLvl == info_level::verbose) {
-                cout << "done." << endl;
-            }
-        }
-        catch(std::exception& e) {
-            if(infoLvl == info_level::verbose) {
-                cout << "FAIL: " << e.what() << endl;
+    read_reference_sequences(executor, infiles, {}, infoLvl);
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief first pass of a two-pass build: counts the locations of each
+ *        feature in all reference sequences, so that all location lists
+ *        can be allocated with their final size before they are filled
+ *
+ *****************************************************************************/
+void count_target_locations(database& db,
+    const std::vector<string>& infiles,
+    int numThreads,
+    info_level infoLvl = info_level::moderate)
+{
+    sketch_reference_sequences(db, infiles, numThreads, infoLvl,
+        [&] (const std::vector<database::sketch>& sketches) {
+            db.count_target_locations(sketches);
+        });
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief estimates the number of distinct features and of locations
+ *        of all reference sequences and sizes the feature table accordingly
+ *
+ *****************************************************************************/
+void reserve_estimated_features(database& db,
+    const std::vector<string>& infiles,
+    int numThreads,
+    info_level infoLvl = info_level::moderate)
+{
+    cardinality_estimator distinct;
+    std::uint64_t numLocations = 0;
+
+    sketch_reference_sequences(db, infiles, numThreads, infoLvl,
+        [&] (const std::vector<database::sketch>& sketches) {
+            for(const auto& sk : sketches) {
+                for(auto f : sk) distinct.insert(splitmix64_hash(std::uint64_t(f)));
+                numLocations += sk.size();
             }
-        }
-        ++i;
+        });
+
+    const auto numFeatures = std::uint64_t(distinct.estimate());
+
+    if(infoLvl != info_level::silent) {
+        clear_current_line(cout);
+        cout << "Estimated " << numFeatures << " features with "
+             << numLocations << " locations.\n"
+             << "Predicted feature table memory: "
+             << (db.predicted_feature_memory(numFeatures, numLocations) >> 20)
+             << " MiB" << endl;
     }
+
+    // leave room for 3 standard errors of the estimate
+    db.reserve_features(database::feature_count_type(1.025 * numFeatures));
 }
 
 
@@ -390,17 +577,39 @@ void prepare_database(database& db, const build_options& opt)
 {
     const auto dbconf = opt.dbconfig;
     if(dbconf.maxLocationsPerFeature > 0) {
-        db.max_locations_per_feature(dbconf.maxLocationsPerFeature);
+        db.max_locations_per_feature(dbconf.maxLocationsPerFeature,
+                                     std::max(1, opt.numThreads));
         cerr << "Max locations per feature set to "
              << dbconf.maxLocationsPerFeature << '\n';
     }
 
+    db.layout(opt.mappableLayout ? database::file_layout::mappable
+                                 : database::file_layout::compact);
+
+    //targets can only be added to plain location lists in a hash table
+    db.unfinalize();
+    db.encoding(database::location_encoding::plain);
+
+    db.insertion_concurrency(opt.numThreads);
+    db.incremental_rehash(opt.incrementalRehash);
+
+    if(dbconf.memoryPolicySet) {
+        db.memory(dbconf.memory);
+        cerr << "Using memory policy: " << to_string(dbconf.memory) << '\n';
+    }
+
     if(dbconf.maxLoadFactor > 0.4 && dbconf.maxLoadFactor < 0.99) {
         db.max_load_factor(dbconf.maxLoadFactor);
         cerr << "Using custom hash table load factor of "
              << dbconf.maxLoadFactor << '\n';
     }
 
+    if(dbconf.featureHash != db.feature_hash_function()) {
+        db.feature_hash_function(dbconf.featureHash);
+        cerr << "Using feature hash function: "
+             << to_string(dbconf.featureHash) << '\n';
+    }
+
     if(!opt.taxonomy.path.empty()) {
         db.reset_taxa_above_sequence_level(
             make_taxonomic_hierarchy(opt.taxonomy.nodesFile,
@@ -446,6 +655,7 @@ void post_process_features(database& db, const build_options& opt)
     const bool notSilent = opt.infoLevel != info_level::silent;
 
     const auto& dbconf = opt.dbconfig;
+    const auto oldFeatureCount = db.feature_count();
 
     if(dbconf.removeOverpopulatedFeatures) {
         auto old = db.feature_count();
@@ -455,7 +665,8 @@ void post_process_features(database& db, const build_options& opt)
                 cout << "\nRemoving features with more than "
                      << maxlpf << " locations... " << flush;
             }
-            auto rem = db.remove_features_with_more_locations_than(maxlpf);
+            auto rem = db.remove_features_with_more_locations_than(
+                           maxlpf, std::max(1, opt.numThreads));
 
             if(notSilent) {
                 cout << rem << " of " << old << " removed." << endl;
@@ -475,7 +686,8 @@ void post_process_features(database& db, const build_options& opt)
 
         auto old = db.feature_count();
         auto rem = db.remove_ambiguous_features(dbconf.removeAmbigFeaturesOnRank,
-                                                dbconf.maxTaxaPerFeature);
+                                                dbconf.maxTaxaPerFeature,
+                                                std::max(1, opt.numThreads));
 
         if(notSilent) {
             cout << rem << " of " << old << "." << endl;
@@ -483,6 +695,15 @@ void post_process_features(database& db, const build_options& opt)
         }
 
     }
+
+    if(db.feature_count() < oldFeatureCount) {
+        if(notSilent) cout << "\nCompacting feature table... " << flush;
+        const bool compacted = db.compact();
+        if(notSilent) {
+            cout << (compacted ? "done." : "skipped (not enough value handles left).")
+                 << endl;
+        }
+    }
 }
 
 
@@ -510,9 +731,26 @@ void add_to_database(database& db, const build_options& opt)
                             opt.taxonomy.mappingPreFilesGlobal,
                             opt.infiles, opt.infoLevel);
 
+        if(opt.twoPassBuild) {
+            if(notSilent) cout << "Counting reference locations." << endl;
+
+            count_target_locations(db, opt.infiles, opt.numThreads,
+                                   opt.infoLevel);
+            db.reserve_counted_locations();
+
+            if(notSilent) clear_current_line(cout);
+        }
+        else if(opt.presizeFeatures) {
+            if(notSilent) cout << "Estimating database size." << endl;
+
+            reserve_estimated_features(db, opt.infiles, opt.numThreads,
+                                       opt.infoLevel);
+        }
+
         if(notSilent) cout << "Processing reference sequences." << endl;
 
-        add_targets_to_database(db, opt.infiles, taxonMap, opt.infoLevel);
+        add_targets_to_database(db, opt.infiles, taxonMap,
+                                opt.numThreads, opt.infoLevel);
 
         if(notSilent) {
             clear_current_line(cout);
@@ -528,6 +766,15 @@ void add_to_database(database& db, const build_options& opt)
 
     post_process_features(db, opt);
 
+    if(opt.packedLocations) {
+        db.encoding(database::location_encoding::packed);
+    }
+
+    //mappable files contain all buckets; don't store unused ones
+    if(db.layout() == database::file_layout::mappable) db.shrink_to_fit();
+
+    if(opt.finalizeIndex) db.finalize();
+
     if(notSilent) {
         cout << "Writing database to file '" << opt.dbfile << "' ... " << flush;
     }
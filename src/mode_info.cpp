@@ -31,6 +31,7 @@
 #include "candidates.h"
 #include "database.h"
 #include "printing.h"
+#include "timer.h"
 #include "typename.h"
 
 
@@ -114,6 +115,191 @@ void show_feature_counts(const string& dbfile)
 
 
 
+/*************************************************************************//**
+ *
+ * @brief prints non-zero histogram entries (value, count) with summary
+ *
+ *****************************************************************************/
+void print_histogram(const string& title,
+                     const hash_table_occupancy::histogram& hist)
+{
+    std::uint64_t total = 0;
+    double sum = 0;
+    for(std::size_t i = 0; i < hist.size(); ++i) {
+        total += hist[i];
+        sum += double(i) * hist[i];
+    }
+
+    cout << title << '\n';
+    if(total < 1) {
+        cout << "    none\n";
+        return;
+    }
+    cout << "    mean: " << (sum / total) << "  max: " << (hist.size() - 1)
+         << "  total: " << total << '\n';
+
+    for(std::size_t i = 0; i < hist.size(); ++i) {
+        if(hist[i] > 0) cout << "    " << i << '\t' << hist[i] << '\n';
+    }
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief shows probe length, cluster length and bucket size histograms
+ *
+ *****************************************************************************/
+void show_feature_table_occupancy(const string& dbfile)
+{
+    auto db = make_database(dbfile);
+    print_static_properties(db);
+    print_content_properties(db);
+
+    const auto occ = db.feature_table_occupancy();
+
+    cout << "===================================================\n";
+    if(db.finalized()) {
+        cout << "finalized index: lookups need no probing\n"
+             << "---------------------------------------------------\n";
+    }
+    else {
+        print_histogram("probe lengths of found features "
+                        "(slots inspected before a feature is found)",
+                        occ.hitProbes);
+        cout << "---------------------------------------------------\n";
+        print_histogram("probe lengths of absent features "
+                        "(occupied slots passed, per home slot)",
+                        occ.missProbes);
+        cout << "---------------------------------------------------\n";
+        print_histogram("cluster lengths "
+                        "(consecutive occupied slots)",
+                        occ.clusters);
+        cout << "---------------------------------------------------\n";
+    }
+    print_histogram("location list sizes", occ.bucketSizes);
+    cout << "===================================================\n";
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief mean and maximum of a histogram
+ *
+ *****************************************************************************/
+std::pair<double,std::size_t>
+histogram_mean_max(const hash_table_occupancy::histogram& hist)
+{
+    std::uint64_t total = 0;
+    double sum = 0;
+    for(std::size_t i = 0; i < hist.size(); ++i) {
+        total += hist[i];
+        sum += double(i) * hist[i];
+    }
+    if(total < 1) return {0.0, 0};
+    return {sum / total, hist.size() - 1};
+}
+
+
+
+/*************************************************************************//**
+ *
+ * @brief inserts the features of a database into a table using each of the
+ *        available feature hash functions and reports timings and
+ *        probe length statistics
+ *
+ *****************************************************************************/
+void show_feature_hash_benchmark(const string& dbfile)
+{
+    using feature = database::feature;
+
+    //key-only table with the same hashing & probing as the database
+    using table_t = hash_multimap<feature, std::uint8_t,
+                                  database::feature_hash,
+                                  std::equal_to<feature>,
+                                  chunk_allocator<std::uint8_t>,
+                                  std::allocator<feature>,
+                                  std::uint8_t,
+                                  database::feature_probing>;
+
+    auto db = make_database(dbfile);
+    print_static_properties(db);
+    print_content_properties(db);
+
+    std::vector<feature> hits;
+    hits.reserve(db.feature_count());
+    db.for_each_feature([&] (feature f) { hits.push_back(f); });
+
+    if(hits.empty()) {
+        cout << "database has no features\n";
+        return;
+    }
+
+    const std::uint8_t* none = nullptr;
+
+    std::vector<feature> misses;
+    misses.reserve(hits.size());
+    {
+        table_t table;
+        for(auto f : hits) table.insert(f, none, none);
+        for(auto f : hits) {
+            if(table.find(~f) == table.end()) misses.push_back(~f);
+        }
+    }
+
+    cout << "===================================================\n"
+         << "features: " << hits.size()
+         << "  absent keys: " << misses.size()
+         << "  max load factor: " << db.max_load_factor() << '\n'
+         << "---------------------------------------------------\n"
+         << "hash\tinsert ms\thit ms\tmiss ms\t"
+            "hit probes (mean/max)\tmiss probes (mean/max)\t"
+            "max cluster\n";
+
+    for(int i = 0; i <= int(last_int_hash()); ++i) {
+        const auto h = int_hash(i);
+
+        table_t table;
+        table.max_load_factor(db.max_load_factor());
+        table.hash_function(database::feature_hash{h});
+
+        timer time;
+        time.start();
+        for(auto f : hits) table.insert(f, none, none);
+        time.stop();
+        const auto insertTime = time.milliseconds();
+
+        std::size_t found = 0;
+        time.restart();
+        for(auto f : hits) found += table.find(f) != table.end();
+        time.stop();
+        const auto hitTime = time.milliseconds();
+
+        time.restart();
+        for(auto f : misses) found += table.find(f) != table.end();
+        time.stop();
+        const auto missTime = time.milliseconds();
+
+        if(found != hits.size()) {
+            cerr << "ERROR: lookups with " << to_string(h) << " failed\n";
+        }
+
+        const auto occ = table.occupancy();
+        const auto hp = histogram_mean_max(occ.hitProbes);
+        const auto mp = histogram_mean_max(occ.missProbes);
+
+        cout << to_string(h) << '\t'
+             << insertTime << '\t' << hitTime << '\t' << missTime << '\t'
+             << hp.first << " / " << hp.second << '\t'
+             << mp.first << " / " << mp.second << '\t'
+             << (occ.clusters.empty() ? 0 : occ.clusters.size() - 1) << '\n';
+    }
+    cout << "===================================================\n";
+}
+
+
+
 /*************************************************************************//**
  *
  * @brief
@@ -298,6 +484,12 @@ void main_mode_info(const cmdline_args& args)
         case info_mode::db_feature_counts:
             show_feature_counts(opt.dbfile);
             break;
+        case info_mode::db_occupancy:
+            show_feature_table_occupancy(opt.dbfile);
+            break;
+        case info_mode::db_hash_benchmark:
+            show_feature_hash_benchmark(opt.dbfile);
+            break;
     }
 }
 
@@ -33,6 +33,7 @@
 #include "classification_statistics.h"
 #include "printing.h"
 #include "config.h"
+#include "memory_policy.h"
 
 
 namespace mc {
@@ -298,10 +299,16 @@ void run_interactive_query_mode(const database& db,
 database
 read_database(const string& filename,
               const database_storage_options& dbopt,
-              const sketching_options& skopt)
+              const sketching_options& skopt,
+              int numThreads)
 {
     database db;
 
+    if(dbopt.memoryPolicySet) {
+        db.memory(dbopt.memory);
+        cerr << "Using memory policy: " << to_string(dbopt.memory) << '\n';
+    }
+
     if(dbopt.maxLoadFactor > 0.4 && dbopt.maxLoadFactor < 0.99) {
         db.max_load_factor(dbopt.maxLoadFactor);
         cerr << "Using custom hash table load factor of "
@@ -311,7 +318,7 @@ read_database(const string& filename,
     cerr << "Reading database from file '" << filename << "' ... " << flush;
 
     try {
-        db.read(filename);
+        db.read(filename, database::scope::everything, numThreads);
         cerr << "done.\n";
     }
     catch(const file_access_error& e) {
@@ -331,15 +338,18 @@ read_database(const string& filename,
             cerr << "\nRemoving features with more than "
                  << maxlpf << " locations... " << std::flush;
 
-            auto rem = db.remove_features_with_more_locations_than(maxlpf);
+            auto rem = db.remove_features_with_more_locations_than(
+                           maxlpf, std::max(1, numThreads));
 
             cerr << rem << " of " << old << " removed.\n";
         }
         //in case new max is less than the database setting
-        db.max_locations_per_feature(dbopt.maxLocationsPerFeature);
+        db.max_locations_per_feature(dbopt.maxLocationsPerFeature,
+                                     std::max(1, numThreads));
     }
     else if(dbopt.maxLocationsPerFeature > 1) {
-        db.max_locations_per_feature(dbopt.maxLocationsPerFeature);
+        db.max_locations_per_feature(dbopt.maxLocationsPerFeature,
+                                     std::max(1, numThreads));
         cerr << "Max locations per feature set to "
              << dbopt.maxLocationsPerFeature << '\n';
     }
@@ -381,7 +391,19 @@ void main_mode_query(const cmdline_args& args)
 {
     auto opt = get_query_options(args);
 
-    auto db = read_database(opt.dbfile, opt.dbconfig, opt.sketching);
+    auto db = read_database(opt.dbfile, opt.dbconfig, opt.sketching,
+                            opt.performance.numThreads);
+
+    if(opt.performance.replicatePerNumaNode) {
+        cerr << "Replicating hash table on NUMA nodes ... " << flush;
+        const auto n = db.replicate_per_numa_node();
+        cerr << n << (n > 1 ? " copies" : " copy");
+        if(n < usable_numa_nodes().size()) {
+            cerr << " (not enough value handles left for more).\n";
+        } else {
+            cerr << (n > 1 ? ".\n" : " (single node).\n");
+        }
+    }
 
     if(!opt.infiles.empty()) {
         cerr << "Classifying query sequences.\n";
@@ -406,6 +406,211 @@ database_storage_options_cli(database_storage_options& opt, error_messages& err)
           "a larger one will improve memory efficiency.\n"
           "default: "s + to_string(defaultDb.max_load_factor())
     )
+    ,
+    (   option("-feature-hash") &
+        value("function", [&](const string& arg) {
+                if(!int_hash_from_name(arg, opt.featureHash)) {
+                    err += "Unknown feature hash function '"s + arg + "'!\n";
+                }
+            })
+            .if_missing([&]{ err += "Function name missing after '-feature-hash'!"; })
+    )
+        %("Hash function that maps features to hash table slots. "
+          "Better mixing functions can lead to shorter probing sequences, "
+          "especially at high load factors (see 'metacache info <database> "
+          "hashes'). The function is stored in the database.\n"
+          "Valid values: "s + int_hash_names() + "\n"
+          "default: "s + to_string(opt.featureHash))
+    ,
+    (   option("-huge-pages") &
+        value("mode", [&](const string& arg) {
+                if(arg == "off") {
+                    opt.memory.pages = page_policy::standard;
+                } else if(arg == "transparent") {
+                    opt.memory.pages = page_policy::transparent_huge;
+                } else if(arg == "explicit") {
+                    opt.memory.pages = page_policy::explicit_huge;
+                } else {
+                    err += "Unknown huge page mode '"s + arg + "'!\n";
+                }
+                opt.memoryPolicySet = true;
+            })
+            .if_missing([&]{ err += "Mode missing after '-huge-pages'!"; })
+    )
+        %("Backs large tables (hash table, location lists) with huge pages "
+          "which reduces TLB misses during random lookups.\n"
+          "'transparent' lets the kernel use transparent huge pages, "
+          "'explicit' uses pre-reserved huge pages (see "
+          "/proc/sys/vm/nr_hugepages) and falls back to transparent ones.\n"
+          "Valid values: off, transparent, explicit\n"
+          "default: off")
+    ,
+    (   option("-numa") &
+        value("policy", [&](const string& arg) {
+                if(arg == "off") {
+                    opt.memory.numa = numa_policy::none;
+                } else if(arg == "interleave") {
+                    opt.memory.numa = numa_policy::interleave;
+                } else if(!arg.empty() && arg.size() < 6 &&
+                          std::all_of(arg.begin(), arg.end(),
+                              [](char c) { return c >= '0' && c <= '9'; }))
+                {
+                    opt.memory.numa = numa_policy::node;
+                    opt.memory.node = std::uint16_t(std::stoul(arg));
+                } else {
+                    err += "Unknown NUMA policy '"s + arg + "'!\n";
+                }
+                opt.memoryPolicySet = true;
+            })
+            .if_missing([&]{ err += "Policy missing after '-numa'!"; })
+    )
+        %("NUMA placement of large tables on multi-socket machines.\n"
+          "'interleave' spreads pages over all memory nodes, a node number "
+          "places them preferably on that node.\n"
+          "Valid values: off, interleave, <node number>\n"
+          "default: off")
+    );
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line options for database file layout
+clipp::group
+database_layout_cli(bool& mappable, error_messages&)
+{
+    using namespace clipp;
+
+    return one_of(
+        option("-mappable").set(mappable)
+            %("Stores the hash table in a layout that keeps the slot of "
+              "every feature. Location lists that don't fit into hash table "
+              "buckets are memory-mapped when the database is loaded and "
+              "only read from disk when needed; the bucket table is still "
+              "read and rebuilt in memory. Files are slightly larger than "
+              "with the compact layout.\n"
+              "default: "s + (mappable ? "on" : "off"))
+        ,
+        option("-compact").set(mappable,false)
+            %("Stores the hash table in the compact, portable layout "
+              "which is rebuilt when the database is loaded.\n"
+              "default: "s + (!mappable ? "on" : "off"))
+    );
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line options for location list encoding
+clipp::group
+location_encoding_cli(bool& packed, error_messages&)
+{
+    using namespace clipp;
+
+    return one_of(
+        option("-packed-locations").set(packed)
+            %("Stores location lists delta and varint encoded which needs "
+              "about half the memory (in RAM and on disk). Queries are "
+              "slightly slower, because location lists have to be decoded.\n"
+              "default: "s + (packed ? "on" : "off"))
+        ,
+        option("-plain-locations").set(packed,false)
+            %("Stores location lists as plain (window, target) arrays.\n"
+              "default: "s + (!packed ? "on" : "off"))
+    );
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line options for read-only database indices
+clipp::group
+database_finalize_cli(bool& finalize, error_messages&)
+{
+    using namespace clipp;
+
+    return one_of(
+        option("-finalize").set(finalize)
+            %("Replaces the hash table with a read-only index based on a "
+              "minimal perfect hash function. It needs less memory and "
+              "lookups need no probing. Features without locations are "
+              "discarded. Targets can still be added with 'modify', but "
+              "the hash table has to be rebuilt for that.\n"
+              "default: "s + (finalize ? "on" : "off"))
+        ,
+        option("-no-finalize").set(finalize,false)
+            %("Stores the (modifiable) hash table.\n"
+              "default: "s + (!finalize ? "on" : "off"))
+    );
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line options for location list allocation
+clipp::group
+build_passes_cli(bool& twoPass, bool& presize, error_messages&)
+{
+    using namespace clipp;
+
+    return one_of(
+        (option("-two-pass").set(twoPass).set(presize,false))
+            %("Reads all reference sequences twice: the first pass counts "
+              "the locations of each feature, so that all location lists "
+              "can be allocated with their exact size in one contiguous "
+              "block before they are filled in the second pass. This lowers "
+              "the peak memory usage of the build, but takes longer.\n"
+              "default: "s + (twoPass ? "on" : "off"))
+        ,
+        (option("-estimate-size").set(presize).set(twoPass,false))
+            %("Reads all reference sequences twice: the first pass estimates "
+              "the number of distinct features, so that the feature table "
+              "can be allocated with (about) its final size and doesn't "
+              "need to be resized while the sequences are added in the "
+              "second pass. Also reports the predicted memory usage.\n"
+              "default: "s + (presize ? "on" : "off"))
+        ,
+        (option("-one-pass").set(twoPass,false).set(presize,false))
+            %("Location lists and feature table grow while reference "
+              "sequences are added.\n"
+              "default: "s + (!twoPass && !presize ? "on" : "off"))
+    );
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line option for feature table growth
+clipp::parameter
+incremental_rehash_cli(bool& incremental, error_messages&)
+{
+    using namespace clipp;
+
+    return option("-incremental-rehash").set(incremental)
+        %("Grows the feature table a few buckets at a time while "
+          "reference sequences are added, so that insertion never stops "
+          "for a complete rehash. The old table is kept until all of its "
+          "buckets are moved, so the peak memory usage is not lower.\n"
+          "default: "s + (incremental ? "on" : "off"));
+}
+
+
+
+//-------------------------------------------------------------------
+/// @brief shared command-line options for database construction threads
+clipp::group
+build_threads_cli(int& numThreads, error_messages& err)
+{
+    using namespace clipp;
+
+    return (
+    (   option("-threads") &
+        integer("#", numThreads)
+            .if_missing([&]{ err += "Number missing after '-threads'!"; })
+    )
+        %("Sets the maximum number of threads used for sketching reference "
+          "sequences and for inserting features into the database.\n"
+          "default (on this machine): "s + to_string(numThreads))
     );
 }
 
@@ -494,6 +699,18 @@ build_mode_cli(build_options& opt, error_messages& err)
               "from other sources during the build phase.\n"
               "default: "s + (opt.resetParents ? "on" : "off"))
         ,
+        database_layout_cli(opt.mappableLayout, err)
+        ,
+        location_encoding_cli(opt.packedLocations, err)
+        ,
+        database_finalize_cli(opt.finalizeIndex, err)
+        ,
+        build_passes_cli(opt.twoPassBuild, opt.presizeFeatures, err)
+        ,
+        incremental_rehash_cli(opt.incrementalRehash, err)
+        ,
+        build_threads_cli(opt.numThreads, err)
+        ,
         database_storage_options_cli(opt.dbconfig, err)
     ),
     catch_unknown(err)
@@ -523,6 +740,8 @@ get_build_options(const cmdline_args& args, build_options opt)
     if(opt.dbconfig.maxLocationsPerFeature < 0)
         opt.dbconfig.maxLocationsPerFeature = database::max_supported_locations_per_feature();
 
+    if(opt.numThreads < 1) opt.numThreads = 1;
+
     auto& sk = opt.sketching;
     if(sk.winstride < 0) sk.winstride = sk.winlen - sk.kmerlen + 1;
 
@@ -635,6 +854,18 @@ modify_mode_cli(build_options& opt, error_messages& err)
               "from other sources during the build phase.\n"
               "default: "s + (opt.resetParents ? "on" : "off"))
         ,
+        database_layout_cli(opt.mappableLayout, err)
+        ,
+        location_encoding_cli(opt.packedLocations, err)
+        ,
+        database_finalize_cli(opt.finalizeIndex, err)
+        ,
+        build_passes_cli(opt.twoPassBuild, opt.presizeFeatures, err)
+        ,
+        incremental_rehash_cli(opt.incrementalRehash, err)
+        ,
+        build_threads_cli(opt.numThreads, err)
+        ,
         database_storage_options_cli(opt.dbconfig, err)
     ),
     catch_unknown(err)
@@ -669,7 +900,11 @@ get_modify_options(const cmdline_args& args, modify_options opt)
     sk.winstride = ts.window_stride();
 
     opt.dbconfig.maxLoadFactor = db.max_load_factor();
+    opt.dbconfig.featureHash = db.feature_hash_function();
     opt.dbconfig.maxLocationsPerFeature = db.max_locations_per_feature();
+    opt.mappableLayout = db.layout() == database::file_layout::mappable;
+    opt.packedLocations = db.encoding() == database::location_encoding::packed;
+    opt.finalizeIndex = db.finalized();
 
     // parse again
     clipp::parse(args, cli);
@@ -680,6 +915,8 @@ get_modify_options(const cmdline_args& args, modify_options opt)
     if(opt.dbconfig.maxLocationsPerFeature < 0)
         opt.dbconfig.maxLocationsPerFeature = database::max_supported_locations_per_feature();
 
+    if(opt.numThreads < 1) opt.numThreads = 1;
+
     return opt;
 }
 
@@ -1035,6 +1272,14 @@ performance_options_cli(performance_tuning_options& opt, error_messages& err)
           "and \n"
           "default: "s + (opt.queryLimit < 1 ? "none"s : to_string(opt.queryLimit))
     )
+    ,
+    option("-numa-replicas").set(opt.replicatePerNumaNode)
+        %("Loads one copy of the database hash table per NUMA node with "
+          "CPUs the process may run on and binds each query thread to one "
+          "of these nodes, so that threads only read "
+          "memory local to their node. Multiplies the memory needed for "
+          "the hash table by the number of nodes.\n"
+          "default: "s + (opt.replicatePerNumaNode ? "on" : "off"))
     );
 }
 
@@ -1560,6 +1805,12 @@ info_mode_cli(info_options& opt, error_messages& err)
             ,
             command("featurecounts")
                 .set(opt.mode, info_mode::db_feature_counts)
+            ,
+            command("occupancy", "occ")
+                .set(opt.mode, info_mode::db_occupancy)
+            ,
+            command("hashes")
+                .set(opt.mode, info_mode::db_hash_benchmark)
         )
         ,
         catch_unknown(err)
@@ -1610,7 +1861,13 @@ string info_mode_examples() {
     "        metacache info refseq.db ref NC_12345.6\n"
     "\n"
     "    List distribution of the number of sequences on rank 'phylum':\n"
-    "        metacache info refseq.db rank phylum\n";
+    "        metacache info refseq.db rank phylum\n"
+    "\n"
+    "    Show how well features are spread in the hash table of 'refseq':\n"
+    "        metacache info refseq.db occupancy\n"
+    "\n"
+    "    Compare the available feature hash functions on the features of 'refseq':\n"
+    "        metacache info refseq.db hashes\n";
 }
 
 
@@ -1659,6 +1916,15 @@ string info_mode_docs() {
         "\n"
         "    matacache info <database> featurecounts\n"
         "       print map (feature -> number of reference locations)\n"
+        "\n"
+        "    matacache info <database> occ[upancy]\n"
+        "       print histograms of hash table probe lengths (for found and\n"
+        "       absent features), cluster lengths and location list sizes\n"
+        "\n"
+        "    matacache info <database> hashes\n"
+        "       insert all features of <database> into test tables using each\n"
+        "       available feature hash function (see build option -feature-hash)\n"
+        "       and print insertion/lookup times and probe length statistics\n"
 
         "\n\n";
 
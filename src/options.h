@@ -38,6 +38,7 @@
 #include "cmdline_utility.h"
 #include "sequence_io.h"
 #include "io_options.h"
+#include "memory_policy.h"
 
 
 namespace mc {
@@ -93,6 +94,9 @@ struct database_storage_options
 {
     float maxLoadFactor = -1;  // < 0 : use database default
 
+    // hash function of the feature hash table
+    int_hash featureHash = int_hash::same_size;
+
     // restrict number of locations per feature
     int maxLocationsPerFeature = -1;  // < 0: use database default
     bool removeOverpopulatedFeatures = false;
@@ -100,6 +104,10 @@ struct database_storage_options
     // restrict number of taxa (on a given rank) per feature
     taxon_rank removeAmbigFeaturesOnRank = taxon_rank::none;
     int maxTaxaPerFeature = 1;
+
+    // huge page & NUMA placement of large tables
+    memory_policy memory;
+    bool memoryPolicySet = false;  // false: use default placement
 };
 
 
@@ -130,6 +138,26 @@ struct build_options
     taxonomy_options taxonomy;
     bool resetParents = false;
 
+    // store hash table in memory-mappable layout
+    bool mappableLayout = false;
+
+    // store location lists delta + varint encoded
+    bool packedLocations = false;
+
+    // replace hash table with read-only perfect hash index
+    bool finalizeIndex = false;
+
+    // count locations first, then fill exactly sized location lists
+    bool twoPassBuild = false;
+
+    // estimate number of features first, then size feature table
+    bool presizeFeatures = false;
+
+    // grow feature table a few buckets at a time while adding targets
+    bool incrementalRehash = false;
+
+    int numThreads = std::thread::hardware_concurrency();
+
     info_level infoLevel = info_level::moderate;
 };
 
@@ -234,6 +262,8 @@ struct performance_tuning_options {
     std::size_t batchSize = 4096;
     //limits number of reads per sequence source (file)
     std::int_least64_t queryLimit = std::numeric_limits<std::int_least64_t>::max();
+    //one feature store copy per NUMA node; threads read their node's copy
+    bool replicatePerNumaNode = false;
 };
 
 
@@ -493,7 +523,8 @@ enum class info_mode {
     basic,
     targets,
     tax_lineages, tax_ranks,
-    db_config, db_statistics, db_feature_map, db_feature_counts
+    db_config, db_statistics, db_feature_map, db_feature_counts,
+    db_occupancy, db_hash_benchmark
 };
 
 struct info_options {
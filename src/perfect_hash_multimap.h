@@ -0,0 +1,660 @@
+/******************************************************************************
+ *
+ * MetaCache - Meta-Genomic Classification Tool
+ *
+ * Copyright (C) 2016-2020 André Müller (muellan@uni-mainz.de)
+ *                       & Robin Kobus  (kobus@uni-mainz.de)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#ifndef MC_PERFECT_HASH_MAP_H_
+#define MC_PERFECT_HASH_MAP_H_
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <type_traits>
+#include <iostream>
+#include <stdexcept>
+#include <cstdint>
+
+#include "hash_int.h"
+#include "io_serialize.h"
+#include "memory_policy.h"
+
+
+namespace mc {
+
+
+/*************************************************************************//**
+ *
+ * @brief   read-only (integer) key -> value multimap based on a
+ *          minimal perfect hash function
+ *
+ * @details Keys are distributed into small groups. Each group gets a
+ *          16-bit 'pilot' that maps all keys of the group to distinct
+ *          slots (PTHash scheme by Pibiri & Trani). Slots store the key,
+ *          the size of its value list and the offset of the list in one
+ *          contiguous value array, so a lookup needs no probing at all:
+ *          one pilot, one slot and the values.
+ *
+ *          Keys are stored as is, so looking up keys that were not
+ *          inserted never produces false positives.
+ *
+ *          Value lists can be shrunk or cleared, but not extended;
+ *          the map can only be rebuilt as a whole with 'assign'.
+ *
+ * @tparam  Key :         integral type with at most 64 bits
+ * @tparam  ValueT :      trivially copyable value type
+ * @tparam  BucketSizeT : type of the value list sizes
+ *
+ *****************************************************************************/
+template<class Key, class ValueT, class BucketSizeT = std::uint8_t>
+class perfect_hash_multimap
+{
+    static_assert(std::is_integral<Key>::value &&
+                  sizeof(Key) <= sizeof(std::uint64_t),
+                  "perfect_hash_multimap needs integral keys");
+
+    static_assert(std::is_trivially_copyable<ValueT>::value,
+                  "perfect_hash_multimap needs trivially copyable values");
+
+public:
+    //---------------------------------------------------------------
+    using key_type         = Key;
+    using value_type       = ValueT;
+    using mapped_type      = ValueT;
+    using bucket_size_type = BucketSizeT;
+    using size_type        = std::uint64_t;
+
+
+    //---------------------------------------------------------------
+    static constexpr std::size_t
+    max_bucket_size() noexcept {
+        return std::numeric_limits<bucket_size_type>::max();
+    }
+
+
+private:
+    //---------------------------------------------------------------
+    #pragma pack(push, 1)
+    //avoid padding bits
+    struct slot
+    {
+        key_type key;
+        std::uint32_t offset;   //relative to the slot's block
+        bucket_size_type size;
+    };
+    //avoid padding bits
+    #pragma pack(pop)
+
+    using pilot_type = std::uint16_t;
+
+    /// @brief offsets are stored relative to blocks of 2^12 slots
+    static constexpr int block_bits = 12;
+
+    /// @brief pilot search is given up after this many hash seeds
+    static constexpr std::uint64_t max_seeds = 64;
+
+    static_assert((std::uint64_t(1) << block_bits) * max_bucket_size()
+                  <= std::numeric_limits<std::uint32_t>::max(),
+                  "block-relative value offsets must fit into 32 bits");
+
+
+public:
+    /****************************************************************
+     * @brief bucket = key + value list; only a view into the map
+     */
+    class bucket_type
+    {
+        friend class perfect_hash_multimap;
+
+    public:
+        using size_type        = bucket_size_type;
+        using key_type         = perfect_hash_multimap::key_type;
+        using value_type       = perfect_hash_multimap::value_type;
+        using reference        = value_type&;
+        using const_reference  = const value_type&;
+        using iterator         = value_type*;
+        using const_iterator   = const value_type*;
+
+        bucket_type() = default;
+
+        /// @brief slots are always in use
+        bool unused() const noexcept { return false; }
+        bool empty()  const noexcept { return (size_ < 1); }
+
+        size_type size() const noexcept { return size_; }
+
+        const key_type& key() const noexcept { return key_; }
+
+        reference
+        operator [](size_type i) noexcept { return values_[i]; }
+
+        const_reference
+        operator [](size_type i) const noexcept { return values_[i]; }
+
+        //-------------------------------------------
+              iterator  begin()       noexcept { return values_; }
+        const_iterator  begin() const noexcept { return values_; }
+        const_iterator cbegin() const noexcept { return values_; }
+
+              iterator  end()       noexcept { return values_ + size_; }
+        const_iterator  end() const noexcept { return values_ + size_; }
+        const_iterator cend() const noexcept { return values_ + size_; }
+
+    private:
+        key_type key_ = key_type(0);
+        value_type* values_ = nullptr;
+        size_type size_ = 0;
+    };
+
+
+private:
+    /****************************************************************
+     * @brief iterates over all slots; dereferencing yields a bucket view
+     */
+    template<class Map, class Bucket>
+    class slot_iterator
+    {
+        friend class perfect_hash_multimap;
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = bucket_type;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = Bucket*;
+        using reference         = Bucket&;
+
+        slot_iterator() = default;
+
+        //iterator -> const_iterator
+        template<class M, class B, class = std::enable_if_t<
+            std::is_convertible<M*,Map*>::value &&
+            std::is_convertible<B*,Bucket*>::value>>
+        slot_iterator(const slot_iterator<M,B>& it) noexcept :
+            map_{it.map_}, i_{it.i_}
+        {}
+
+        reference operator * () const noexcept {
+            bucket_ = map_->bucket_view(i_);
+            return bucket_;
+        }
+        pointer operator -> () const noexcept { return &(**this); }
+
+        slot_iterator& operator ++ () noexcept { ++i_; return *this; }
+        slot_iterator operator ++ (int) noexcept {
+            auto old = *this; ++i_; return old;
+        }
+
+        friend bool
+        operator == (const slot_iterator& a, const slot_iterator& b) noexcept {
+            return a.i_ == b.i_;
+        }
+        friend bool
+        operator != (const slot_iterator& a, const slot_iterator& b) noexcept {
+            return a.i_ != b.i_;
+        }
+
+    private:
+        template<class,class> friend class slot_iterator;
+
+        slot_iterator(Map* map, size_type i) noexcept: map_{map}, i_{i} {}
+
+        Map* map_ = nullptr;
+        size_type i_ = 0;
+        mutable bucket_type bucket_;
+    };
+
+
+public:
+    //---------------------------------------------------------------
+    using reference       = bucket_type&;
+    using const_reference = const bucket_type&;
+    using iterator        = slot_iterator<perfect_hash_multimap,bucket_type>;
+    using const_iterator  = slot_iterator<const perfect_hash_multimap,
+                                          const bucket_type>;
+
+
+    //---------------------------------------------------------------
+    perfect_hash_multimap() = default;
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief (re-)builds the map from a range of buckets that provide
+     *        'key()', 'size()', 'begin()' and 'end()';
+     *        empty buckets are skipped
+     */
+    template<class BucketIterator>
+    void assign(BucketIterator first, BucketIterator last)
+    {
+        clear();
+
+        std::vector<BucketIterator> sources;
+        for(; first != last; ++first) {
+            if(!first->empty()) sources.push_back(first);
+        }
+        if(sources.empty()) return;
+
+        const size_type n = sources.size();
+
+        std::vector<std::uint64_t> hashes(n);
+        for(seed_ = 0; ; ++seed_) {
+            //duplicate keys can never be placed
+            if(seed_ >= max_seeds) {
+                clear();
+                throw std::runtime_error{
+                    "perfect_hash_multimap: no perfect hash function found"};
+            }
+            for(size_type i = 0; i < n; ++i) {
+                hashes[i] = hash(sources[i]->key());
+            }
+            if(find_pilots(hashes)) break;
+        }
+
+        //order buckets by slot
+        slots_.resize(n);
+        std::vector<BucketIterator> bySlot(n);
+        for(size_type i = 0; i < n; ++i) {
+            bySlot[slot_index(hashes[i])] = sources[i];
+        }
+        sources.clear();
+        sources.shrink_to_fit();
+        hashes.clear();
+        hashes.shrink_to_fit();
+
+        //slots & value offsets
+        blockOffsets_.reserve((n >> block_bits) + 1);
+        size_type offset = 0;
+        for(size_type i = 0; i < n; ++i) {
+            if((i & ((size_type(1) << block_bits) - 1)) == 0) {
+                blockOffsets_.push_back(offset);
+            }
+            auto& s = slots_[i];
+            s.key    = bySlot[i]->key();
+            s.offset = std::uint32_t(offset - blockOffsets_.back());
+            s.size   = bucket_size_type(bySlot[i]->size());
+            offset += s.size;
+        }
+
+        values_.reserve(offset);
+        for(const auto& b : bySlot) {
+            values_.insert(values_.end(), b->begin(), b->end());
+        }
+        numValues_ = offset;
+    }
+
+
+    //---------------------------------------------------------------
+    size_type key_count() const noexcept {
+        return slots_.size();
+    }
+    //-----------------------------------------------------
+    size_type value_count() const noexcept {
+        return numValues_;
+    }
+    //-----------------------------------------------------
+    bool empty() const noexcept {
+        return slots_.empty();
+    }
+    //-----------------------------------------------------
+    /// @brief every key has exactly one slot
+    size_type bucket_count() const noexcept {
+        return slots_.size();
+    }
+    //-----------------------------------------------------
+    size_type non_empty_bucket_count() const noexcept {
+        return size_type(std::count_if(slots_.begin(), slots_.end(),
+                         [](const slot& s) { return s.size > 0; }));
+    }
+    //-----------------------------------------------------
+    size_type bucket_size(size_type i) const noexcept {
+        return slots_[i].size;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @return  iterator to bucket with all values of a key
+     *          or end iterator if key not found
+     */
+    iterator
+    find(const key_type& key) {
+        return iterator{this, find_slot(key)};
+    }
+    //-----------------------------------------------------
+    const_iterator
+    find(const key_type& key) const {
+        return const_iterator{this, find_slot(key)};
+    }
+
+    //-----------------------------------------------------
+    /**
+     * @brief   looks up a range of keys and calls 'consume(key, bucket_iter)'
+     *          for each of them in order (bucket_iter == end() if not found)
+     *
+     * @details Keys are processed in groups: first all pilots are
+     *          prefetched, then all slots and then all value lists, so that
+     *          the cache misses of all lookups within a group overlap.
+     *
+     * @tparam  ForwardIterator : iterator over keys; must be multi-pass
+     */
+    template<class ForwardIterator, class Consumer>
+    void
+    find_batch(ForwardIterator first, ForwardIterator last,
+               Consumer&& consume) const
+    {
+        if(slots_.empty()) {
+            for(; first != last; ++first) consume(*first, end());
+            return;
+        }
+
+        std::uint64_t hashes[find_batch_size()];
+        size_type found[find_batch_size()];
+
+        while(first != last) {
+            const auto groupBegin = first;
+            std::size_t n = 0;
+
+            for(; n < find_batch_size() && first != last; ++n, ++first) {
+                hashes[n] = hash(*first);
+                prefetch(pilots_.data() + group_of(hashes[n]));
+            }
+
+            for(std::size_t i = 0; i < n; ++i) {
+                found[i] = slot_index(hashes[i]);
+                prefetch(slots_.data() + found[i]);
+            }
+
+            auto key = groupBegin;
+            for(std::size_t i = 0; i < n; ++i, ++key) {
+                const auto& s = slots_[found[i]];
+                if(s.key == *key) {
+                    prefetch(values_.data() + value_offset(found[i]));
+                } else {
+                    found[i] = slots_.size();
+                }
+            }
+
+            key = groupBegin;
+            for(std::size_t i = 0; i < n; ++i, ++key) {
+                consume(*key, const_iterator{this, found[i]});
+            }
+        }
+    }
+
+    //-----------------------------------------------------
+    /// @brief maximum number of lookups that overlap in 'find_batch'
+    static constexpr std::size_t find_batch_size() noexcept {
+        return 32;
+    }
+
+    //-----------------------------------------------------
+    size_type
+    count(const key_type& key) const {
+        const auto i = find_slot(key);
+        return i < slots_.size() ? slots_[i].size : 0;
+    }
+
+
+    /****************************************************************
+     * @brief discards values with indices n-1 ... size-1
+     */
+    void
+    shrink(const_iterator it, bucket_size_type n)
+    {
+        auto& s = slots_[it.i_];
+        if(s.size > n) {
+            numValues_ -= (s.size - n);
+            s.size = n;
+        }
+    }
+    //-----------------------------------------------------
+    /**
+     * @brief discards all values in bucket, but keeps bucket with key
+     */
+    void
+    clear(const_iterator it)
+    {
+        shrink(it, 0);
+    }
+
+    //---------------------------------------------------------------
+    void clear()
+    {
+        slots_.clear();
+        slots_.shrink_to_fit();
+        pilots_.clear();
+        pilots_.shrink_to_fit();
+        remap_.clear();
+        remap_.shrink_to_fit();
+        blockOffsets_.clear();
+        blockOffsets_.shrink_to_fit();
+        values_.clear();
+        values_.shrink_to_fit();
+        numValues_ = 0;
+        seed_ = 0;
+        numGroups_ = 0;
+        numDenseGroups_ = 0;
+        tableSize_ = 0;
+    }
+
+
+    //---------------------------------------------------------------
+    const_iterator
+     begin() const noexcept { return const_iterator{this, 0}; }
+    const_iterator
+    cbegin() const noexcept { return const_iterator{this, 0}; }
+    iterator
+     begin() noexcept { return iterator{this, 0}; }
+    //-----------------------------------------------------
+    const_iterator
+     end() const noexcept { return const_iterator{this, slots_.size()}; }
+    const_iterator
+    cend() const noexcept { return const_iterator{this, slots_.size()}; }
+    iterator
+     end() noexcept { return iterator{this, slots_.size()}; }
+
+
+    //---------------------------------------------------------------
+    friend void read_binary(std::istream& is, perfect_hash_multimap& m) {
+        m.clear();
+        read_binary(is, m.seed_);
+        read_binary(is, m.numGroups_);
+        read_binary(is, m.numDenseGroups_);
+        read_binary(is, m.tableSize_);
+        read_binary(is, m.numValues_);
+        read_binary(is, m.pilots_);
+        read_binary(is, m.remap_);
+        read_binary(is, m.slots_);
+        read_binary(is, m.blockOffsets_);
+        read_binary(is, m.values_);
+    }
+
+    //---------------------------------------------------------------
+    friend void write_binary(std::ostream& os, const perfect_hash_multimap& m) {
+        write_binary(os, m.seed_);
+        write_binary(os, m.numGroups_);
+        write_binary(os, m.numDenseGroups_);
+        write_binary(os, m.tableSize_);
+        write_binary(os, m.numValues_);
+        write_binary(os, m.pilots_);
+        write_binary(os, m.remap_);
+        write_binary(os, m.slots_);
+        write_binary(os, m.blockOffsets_);
+        write_binary(os, m.values_);
+    }
+
+
+private:
+    //---------------------------------------------------------------
+    std::uint64_t hash(const key_type& key) const noexcept {
+        return murmur3_fmix(std::uint64_t(key) ^
+                            (seed_ * std::uint64_t(0x9e3779b97f4a7c15)));
+    }
+
+    //---------------------------------------------------------------
+    /**
+     * @brief skewed distribution: 60% of all keys go into 30% of the groups
+     *        so that large groups are placed while the table is still empty
+     */
+    size_type group_of(std::uint64_t hash) const noexcept {
+        const auto h = hash >> 32;
+        if((hash & 0xffffffff) < std::uint64_t(0.6 * 0xffffffff)) {
+            return h % numDenseGroups_;
+        }
+        return numDenseGroups_ + h % (numGroups_ - numDenseGroups_);
+    }
+
+    //---------------------------------------------------------------
+    size_type position(std::uint64_t hash, pilot_type pilot) const noexcept {
+        return murmur3_fmix(hash ^ splitmix64_hash(std::uint64_t(pilot) + 1))
+               % tableSize_;
+    }
+
+    //---------------------------------------------------------------
+    size_type slot_index(std::uint64_t hash) const noexcept {
+        const auto pos = position(hash, pilots_[group_of(hash)]);
+        return pos < slots_.size() ? pos : remap_[pos - slots_.size()];
+    }
+
+    //---------------------------------------------------------------
+    size_type find_slot(const key_type& key) const noexcept {
+        if(slots_.empty()) return 0;
+        const auto i = slot_index(hash(key));
+        return slots_[i].key == key ? i : slots_.size();
+    }
+
+    //---------------------------------------------------------------
+    size_type value_offset(size_type i) const noexcept {
+        return blockOffsets_[i >> block_bits] + slots_[i].offset;
+    }
+
+    //---------------------------------------------------------------
+    bucket_type bucket_view(size_type i) const noexcept {
+        bucket_type b;
+        b.key_ = slots_[i].key;
+        b.values_ = const_cast<value_type*>(values_.data()) + value_offset(i);
+        b.size_ = slots_[i].size;
+        return b;
+    }
+
+
+    //---------------------------------------------------------------
+    /**
+     * @brief  finds a pilot for each group of keys, so that all keys are
+     *         mapped to distinct positions in [0,tableSize);
+     *         the slots of the (few) positions >= number of keys are
+     *         remapped to the remaining free slots below
+     * @return false, if no pilot could be found for some group
+     */
+    bool find_pilots(const std::vector<std::uint64_t>& hashes)
+    {
+        const size_type n = hashes.size();
+        //~ 4 keys per group, 3% empty table positions
+        numGroups_ = std::max(size_type(2), n / 4);
+        numDenseGroups_ = std::max(size_type(1), size_type(0.3 * numGroups_));
+        tableSize_ = size_type(n / 0.97) + 1;
+
+        //sort keys by group (counting sort)
+        std::vector<size_type> groupBegin(numGroups_ + 1, 0);
+        for(auto h : hashes) ++groupBegin[group_of(h) + 1];
+        for(size_type g = 0; g < numGroups_; ++g) {
+            groupBegin[g+1] += groupBegin[g];
+        }
+        std::vector<std::uint64_t> grouped(n);
+        {
+            auto next = groupBegin;
+            for(auto h : hashes) grouped[next[group_of(h)]++] = h;
+        }
+
+        //place large groups first
+        std::vector<size_type> order(numGroups_);
+        for(size_type g = 0; g < numGroups_; ++g) order[g] = g;
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_type a, size_type b) {
+                return (groupBegin[a+1] - groupBegin[a]) >
+                       (groupBegin[b+1] - groupBegin[b]);
+            });
+
+        pilots_.assign(numGroups_, 0);
+        std::vector<bool> taken(tableSize_, false);
+        std::vector<size_type> positions;
+
+        for(auto g : order) {
+            const auto first = grouped.begin() + groupBegin[g];
+            const auto last  = grouped.begin() + groupBegin[g+1];
+            if(first == last) break;
+
+            bool placed = false;
+            for(std::uint64_t p = 0; !placed &&
+                p <= std::numeric_limits<pilot_type>::max(); ++p)
+            {
+                positions.clear();
+                placed = true;
+                for(auto h = first; h != last; ++h) {
+                    const auto pos = position(*h, pilot_type(p));
+                    if(taken[pos] || std::find(positions.begin(),
+                                               positions.end(), pos)
+                                     != positions.end())
+                    {
+                        placed = false;
+                        break;
+                    }
+                    positions.push_back(pos);
+                }
+                if(placed) {
+                    pilots_[g] = pilot_type(p);
+                    for(auto pos : positions) taken[pos] = true;
+                }
+            }
+            if(!placed) return false;
+        }
+
+        //remap positions beyond the number of keys to free slots
+        remap_.assign(tableSize_ - n, 0);
+        size_type freeSlot = 0;
+        for(size_type pos = n; pos < tableSize_; ++pos) {
+            if(taken[pos]) {
+                while(taken[freeSlot]) ++freeSlot;
+                remap_[pos - n] = freeSlot++;
+            }
+        }
+        return true;
+    }
+
+
+    //---------------------------------------------------------------
+    std::uint64_t seed_ = 0;
+    size_type numGroups_ = 0;
+    size_type numDenseGroups_ = 0;
+    size_type tableSize_ = 0;
+    size_type numValues_ = 0;
+    std::vector<pilot_type> pilots_;
+    std::vector<size_type> remap_;
+    //large arrays follow the current memory policy
+    std::vector<slot,page_allocator<slot>> slots_;
+    std::vector<std::uint64_t> blockOffsets_;
+    std::vector<value_type,page_allocator<value_type>> values_;
+};
+
+
+} // namespace mc
+
+
+#endif
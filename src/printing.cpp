@@ -31,6 +31,7 @@
 #include "database.h"
 #include "stat_confusion.h"
 #include "taxonomy.h"
+#include "cpu_dispatch.h"
 #include "options.h"
 
 #include "printing.h"
@@ -624,7 +625,9 @@ void print_static_properties(const database& db)
         << "------------------------------------------------\n"
         << "sketcher type        " << type_name<database::sketcher>() << '\n'
         << "feature type         " << type_name<feature_t>() << " " << (sizeof(feature_t)*CHAR_BIT) << " bits\n"
-        << "feature hash         " << type_name<database::feature_hash>() << '\n'
+        << "feature hash         " << type_name<database::feature_hash>()
+                                   << " (" << to_string(db.feature_hash_function()) << ")\n"
+        << "probing scheme       " << type_name<database::feature_probing>() << '\n'
         << "kmer size            " << std::uint64_t(db.target_sketcher().kmer_size()) << '\n'
         << "kmer limit           " << std::uint64_t(db.target_sketcher().max_kmer_size()) << '\n'
         << "sketch size          " << db.target_sketcher().sketch_size() << '\n'
@@ -632,6 +635,11 @@ void print_static_properties(const database& db)
         << "bucket size type     " << type_name<bkt_sz_t>() << " " << (sizeof(bkt_sz_t)*CHAR_BIT) << " bits\n"
         << "max. locations       " << std::uint64_t(db.max_locations_per_feature()) << '\n'
         << "location limit       " << std::uint64_t(db.max_supported_locations_per_feature()) << '\n'
+        << "file layout          " << (db.layout() == database::file_layout::mappable ? "mappable" : "compact") << '\n'
+        << "location encoding    " << (db.encoding() == database::location_encoding::packed ? "packed" : "plain") << '\n'
+        << "feature index        " << (db.finalized() ? "minimal perfect hash (read-only)" : "hash table") << '\n'
+        << "memory policy        " << to_string(db.memory()) << '\n'
+        << "cpu kernels          " << to_string(active_cpu_isa()) << '\n'
         << "------------------------------------------------"
         << std::endl;
 }
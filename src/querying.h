@@ -108,19 +108,22 @@ query_id query_batched(
     execOpt.batch_size(opt.batchSize);
     execOpt.queue_size(opt.numThreads > 1 ? opt.numThreads + 4 : 0);
     execOpt.on_error(handleErrors);
+    //each worker reads the feature store replica of its NUMA node
+    execOpt.numa_nodes(db.replica_nodes());
 
     batch_executor<sequence_query> executor {
         execOpt,
         // classifies a batch of input queries
-        [&](int, std::vector<sequence_query>& batch) {
+        [&](int id, std::vector<sequence_query>& batch) {
             auto resultsBuffer = getBuffer();
             database::matches_sorter targetMatches;
+            const auto replica = unsigned(id) % db.replica_count();
 
             for(auto& seq : batch) {
                 targetMatches.clear();
 
-                db.accumulate_matches(seq.seq1, targetMatches);
-                db.accumulate_matches(seq.seq2, targetMatches);
+                db.accumulate_matches(seq.seq1, targetMatches, replica);
+                db.accumulate_matches(seq.seq2, targetMatches, replica);
                 targetMatches.sort();
 
                 update(resultsBuffer, seq, targetMatches.locations());
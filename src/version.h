@@ -26,7 +26,15 @@
 
 #define MC_VERSION 20200309
 
-#define MC_DB_VERSION 20200323
+#define MC_DB_VERSION 20261016
+
+// oldest database version that can still be read
+#define MC_DB_VERSION_MIN 20200323
+
+// database version that introduced the hash table format fields
+// (layout, location encoding, finalization, feature hash function,
+// probing scheme and bucket variant)
+#define MC_DB_VERSION_TABLE_FORMAT 20261016
 
 #define MC_VERSION_STRING "1.1.1"
 
@@ -1,5 +1,7 @@
 
 #include "../src/hash_multimap.h"
+#include "../src/perfect_hash_multimap.h"
+#include "../src/hash_int.h"
 
 #include "../src/stat_moments.h"
 #include "../src/timer.h"
@@ -7,13 +9,38 @@
 #include <stdexcept>
 #include <random>
 #include <fstream>
+#include <cstdio>
+#include <cstdlib>
 #include <vector>
 #include <set>
+#include <map>
+
+#include <unistd.h>
 
 
 using namespace mc;
 
 
+//-------------------------------------------------------------------
+template<class Key, class Value, class ProbingScheme>
+using probing_hash_multimap = hash_multimap<Key,Value,
+    same_size_hash<Key>, std::equal_to<Key>,
+    chunk_allocator<Value>, std::allocator<Key>, std::uint8_t,
+    ProbingScheme>;
+
+
+
+//-------------------------------------------------------------------
+template<class Key, class Value>
+using compact_hash_multimap = hash_multimap<Key,Value,
+    same_size_hash<Key>, std::equal_to<Key>,
+    chunk_handle_allocator<Value>>;
+
+static_assert(sizeof(compact_hash_multimap<std::uint32_t,std::uint32_t>::bucket_type) <= 12,
+              "compact buckets should need at most 12 bytes");
+
+
+
 //-------------------------------------------------------------------
 template<class Key, class Value>
 class key_value_pair_filler
@@ -88,7 +115,7 @@ void print_hash_multimap(const HashMultimap& hm, OStream& os = std::cout)
 {
     int i = 0;
     for(const auto& b : hm) {
-        os << i << ": \t" << b.key() << " [" << int(b.probe_length()) << "] = \t";
+        os << i << ": \t" << b.key() << " = \t";
         for(const auto& v : b) {
             os << v << " ";
         }
@@ -100,40 +127,6 @@ void print_hash_multimap(const HashMultimap& hm, OStream& os = std::cout)
 
 
 
-//-------------------------------------------------------------------
-template<class HashMultiMap>
-void hash_multimap_check_binary_IO(const HashMultiMap& hm)
-{
-    {
-        std::ofstream os {"test.map", std::ios::binary};
-        write_binary(os, hm);
-    }
-
-    HashMultiMap hm2;
-    {
-        std::ifstream is {"test.map", std::ios::binary};
-        read_binary(is, hm2);
-    }
-
-    if(hm.key_count() != hm2.key_count()) {
-        std::ofstream os1 {"test1.out"};
-        print_hash_multimap(hm, os1);
-
-        std::ofstream os2 {"test2.out"};
-        print_hash_multimap(hm2, os2);
-
-        throw std::runtime_error{
-            "hash_multimap::key_count() inconsistent after deserialization"};
-    }
-    if(hm.value_count() != hm2.value_count()) {
-
-        throw std::runtime_error{
-            "hash_multimap::value_count() inconsistent after deserialization"};
-    }
-}
-
-
-
 //-------------------------------------------------------------------
 template<class HashMultiMap, class K, class V>
 void hash_multimap_check_book_keeping(
@@ -141,7 +134,7 @@ void hash_multimap_check_book_keeping(
     const std::vector<std::pair<K,V>>& kvpairs,
     const std::string& message = "")
 {
-    using key_t = std::decay_t<HashMultiMap>::key_type;
+    using key_t = typename std::decay_t<HashMultiMap>::key_type;
 
     if(kvpairs.size() != hm.value_count()) {
         std::cout << kvpairs.size() << " != " << hm.value_count() << std::endl;
@@ -194,6 +187,52 @@ void hash_multimap_check_presence(HashMultiMap&& hm,
 
 
 
+//-------------------------------------------------------------------
+template<class HashMultiMap, class K, class V>
+void hash_multimap_check_binary_IO(const HashMultiMap& hm,
+                                   const std::vector<std::pair<K,V>>& kvpairs)
+{
+    {
+        std::ofstream os {"test.map", std::ios::binary};
+        write_binary(os, hm);
+    }
+
+    HashMultiMap hm2;
+    hm2.max_load_factor(hm.max_load_factor());
+    {
+        std::ifstream is {"test.map", std::ios::binary};
+        read_binary(is, hm2);
+    }
+
+    if(hm.key_count() != hm2.key_count()) {
+        std::ofstream os1 {"test1.out"};
+        print_hash_multimap(hm, os1);
+
+        std::ofstream os2 {"test2.out"};
+        print_hash_multimap(hm2, os2);
+
+        throw std::runtime_error{
+            "hash_multimap::key_count() inconsistent after deserialization"};
+    }
+    if(hm.value_count() != hm2.value_count()) {
+
+        throw std::runtime_error{
+            "hash_multimap::value_count() inconsistent after deserialization"};
+    }
+
+    hash_multimap_check_presence(hm2, kvpairs, "after deserialization");
+    {
+        HashMultiMap hm3;
+        hm3.max_load_factor(hm.max_load_factor());
+        std::ifstream is {"test.map", std::ios::binary};
+        read_binary(is, hm3, 3);
+        hash_multimap_check_presence(hm3, kvpairs,
+                                     "after concurrent deserialization");
+    }
+}
+
+
+
 //-------------------------------------------------------------------
 template<class HashMultiMap, class K>
 void hash_multimap_check_absence(HashMultiMap&& hm,
@@ -214,6 +253,115 @@ void hash_multimap_check_absence(HashMultiMap&& hm,
 
 
 
+//-------------------------------------------------------------------
+/// @brief unique file in the temporary directory; removed on destruction
+class temporary_file
+{
+public:
+    temporary_file() {
+        const char* dir = std::getenv("TMPDIR");
+        name_ = std::string(dir ? dir : "/tmp") + "/hash_multimap_test_XXXXXX";
+        const int fd = mkstemp(&name_[0]);
+        if(fd < 0) {
+            throw std::runtime_error{"could not create temporary file"};
+        }
+        close(fd);
+    }
+    ~temporary_file() { std::remove(name_.c_str()); }
+
+    temporary_file(const temporary_file&) = delete;
+    temporary_file& operator = (const temporary_file&) = delete;
+
+    const std::string& name() const noexcept { return name_; }
+
+private:
+    std::string name_;
+};
+
+
+
+//-------------------------------------------------------------------
+template<class HashMultiMap, class K, class V>
+void hash_multimap_check_layout_IO(const HashMultiMap& hm,
+                                   const std::vector<std::pair<K,V>>& kvpairs)
+{
+    const temporary_file file;
+    {
+        std::ofstream os {file.name(), std::ios::binary};
+        write_binary_layout(os, hm);
+    }
+
+    //read values
+    {
+        HashMultiMap hm2;
+        std::ifstream is {file.name(), std::ios::binary};
+        read_binary_layout(is, hm2);
+        hash_multimap_check_presence(hm2, kvpairs, "after layout deserialization");
+    }
+    //map values
+    {
+        HashMultiMap hm2;
+        std::ifstream is {file.name(), std::ios::binary};
+        read_binary_layout(is, hm2, file.name());
+        hash_multimap_check_presence(hm2, kvpairs, "after layout mapping");
+    }
+}
+
+
+
+//-------------------------------------------------------------------
+template<class HashMultiMap, class K, class V>
+void hash_multimap_check_perfect_hash(const HashMultiMap& hm,
+                                      const std::vector<std::pair<K,V>>& kvpairs)
+{
+    using map_t = perfect_hash_multimap<
+        typename HashMultiMap::key_type, typename HashMultiMap::value_type,
+        typename HashMultiMap::bucket_size_type>;
+
+    map_t phm;
+    phm.assign(hm.begin(), hm.end());
+    hash_multimap_check_presence(phm, kvpairs, "in perfect hash map");
+
+    //keys that were not inserted
+    std::set<K> keys;
+    for(const auto& p : kvpairs) keys.insert(p.first);
+    std::vector<K> absent;
+    std::mt19937_64 urng;
+    while(absent.size() < 1000) {
+        const auto k = K(urng());
+        if(keys.find(k) == keys.end()) absent.push_back(k);
+    }
+    hash_multimap_check_absence(phm, absent, "in perfect hash map");
+
+    //batched query
+    std::size_t found = 0;
+    phm.find_batch(keys.begin(), keys.end(), [&](const K& k, auto it) {
+        if(it == phm.end() || it->key() != k) {
+            throw std::runtime_error{
+                "perfect_hash_multimap::find_batch inconsistent with find"};
+        }
+        ++found;
+    });
+    if(found != keys.size()) {
+        throw std::runtime_error{
+            "perfect_hash_multimap::find_batch did not visit all keys"};
+    }
+
+    {
+        std::ofstream os {"test.map", std::ios::binary};
+        write_binary(os, phm);
+    }
+    map_t phm2;
+    {
+        std::ifstream is {"test.map", std::ios::binary};
+        read_binary(is, phm2);
+    }
+    hash_multimap_check_presence(phm2, kvpairs,
+                                 "after perfect hash map deserialization");
+}
+
+
+
 //-------------------------------------------------------------------
 template<class HashMultiMap, class KeyValGen>
 void hash_multimap_correctness(HashMultiMap&& hm, std::size_t n, KeyValGen&& keyValGen)
@@ -246,10 +394,9 @@ void hash_multimap_correctness(HashMultiMap&& hm, std::size_t n, KeyValGen&& key
     }
 
     //erase
-/*
 //    std::cout << "erase & query" << std::endl;
-    using key_t = std::decay_t<HashMultiMap>::key_type;
-    using val_t = std::decay_t<HashMultiMap>::value_type;
+    using key_t = typename std::decay_t<HashMultiMap>::key_type;
+    using val_t = typename std::decay_t<HashMultiMap>::value_type;
 
     auto m = std::size_t(kvpairs.size() / 3);
     std::vector<key_t> erased;
@@ -281,9 +428,142 @@ void hash_multimap_correctness(HashMultiMap&& hm, std::size_t n, KeyValGen&& key
     hash_multimap_check_presence(hm, kvpairs, "after erasing others");
     //query erased
     hash_multimap_check_absence(hm, erased, ": was erased before");
-*/
 
-    hash_multimap_check_binary_IO(hm);
+    //batched query
+    {
+        using key_t = typename std::decay_t<HashMultiMap>::key_type;
+        std::vector<key_t> keys;
+        for(const auto& p : kvpairs) keys.push_back(p.first);
+
+        std::size_t i = 0;
+        hm.find_batch(keys.begin(), keys.end(), [&](const key_t& k, auto it) {
+            if(k != keys[i] || it != hm.find(k)) {
+                throw std::runtime_error{
+                    "hash_multimap::find_batch inconsistent with find"};
+            }
+            ++i;
+        });
+        if(i != keys.size()) {
+            throw std::runtime_error{
+                "hash_multimap::find_batch did not visit all keys"};
+        }
+    }
+
+    //occupancy histograms
+    {
+        const auto occ = hm.occupancy();
+        std::uint64_t keys = 0;
+        for(auto n : occ.hitProbes) keys += n;
+        std::uint64_t slots = 0;
+        for(auto n : occ.missProbes) slots += n;
+        std::uint64_t clustered = 0;
+        for(std::size_t i = 0; i < occ.clusters.size(); ++i) {
+            clustered += i * occ.clusters[i];
+        }
+        if(keys != hm.key_count() || slots != hm.bucket_count() ||
+           clustered != hm.key_count() + hm.erased_count())
+        {
+            throw std::runtime_error{
+                "hash_multimap::occupancy: inconsistent histograms"};
+        }
+    }
+
+    //concurrent insertion & query
+    {
+        std::decay_t<HashMultiMap> hm3;
+        hm3.insert_concurrently(kvpairs, hm3.max_bucket_size(), 4);
+        hash_multimap_check_presence(hm3, kvpairs, "after concurrent insertion");
+    }
+
+    //incremental rehashing & query
+    {
+        std::decay_t<HashMultiMap> hm5;
+        hm5.rehash(64);
+        hm5.incremental_rehash(true);
+        bool migrating = false;
+        auto inserted = kvpairs;
+        inserted.clear();
+        for(const auto& p : kvpairs) {
+            //if insertion failed due to the limited bucket size, ignore (key,value)
+            if(hm5.insert(p.first, p.second) != hm5.end()) inserted.push_back(p);
+            if(hm5.rehashing()) migrating = true;
+        }
+        if(!migrating && hm5.incremental_rehash()) {
+            throw std::runtime_error{
+                "hash_multimap: no incremental rehash happened"};
+        }
+        hash_multimap_check_presence(hm5, inserted, "during incremental rehash");
+        hm5.complete_rehash();
+        hash_multimap_check_presence(hm5, inserted, "after incremental rehash");
+        if(hm5.non_empty_bucket_count() != hm5.key_count()) {
+            throw std::runtime_error{
+                "hash_multimap: buckets missing after incremental rehash"};
+        }
+    }
+
+    //exactly pre-sized insertion & query
+    {
+        using map_t = std::decay_t<HashMultiMap>;
+        using count_t = typename map_t::bucket_size_type;
+
+        std::map<key_t,count_t> counts;
+        for(const auto& p : kvpairs) ++counts[p.first];
+
+        map_t hm4;
+        hm4.reserve_exactly({counts.begin(), counts.end()});
+        const auto nbuckets = hm4.bucket_count();
+
+        for(const auto& p : kvpairs) hm4.insert(p.first, p.second);
+
+        if(hm4.bucket_count() != nbuckets) {
+            throw std::runtime_error{
+                "hash_multimap::reserve_exactly did not prevent rehashing"};
+        }
+        for(const auto& b : hm4) {
+            if(!b.unused() && b.size() != b.capacity() &&
+               b.capacity() > b.inline_capacity())
+            {
+                throw std::runtime_error{
+                    "hash_multimap::reserve_exactly: wrong bucket capacity"};
+            }
+        }
+        hash_multimap_check_presence(hm4, kvpairs, "after exact pre-sizing");
+    }
+
+    hash_multimap_check_binary_IO(hm, kvpairs);
+    hash_multimap_check_layout_IO(hm, kvpairs);
+
+    //compact & query
+    hm.compact();
+    if(hm.erased_count() != 0) {
+        throw std::runtime_error{
+            "hash_multimap::compact did not remove erased slots" };
+    }
+    hash_multimap_check_presence(hm, kvpairs, "after compaction");
+    hash_multimap_check_absence(hm, erased, ": was erased before compaction");
+
+    hash_multimap_check_perfect_hash(hm, kvpairs);
+}
+
+
+
+//-------------------------------------------------------------------
+template<class Key, class Value, class KeyValGen>
+void hash_multimap_check_hash_switch(std::size_t n, KeyValGen&& keyValGen)
+{
+    hash_multimap<Key,Value,selectable_hash<Key>> hm;
+
+    auto kvpairs = keyValGen(n, hm);
+
+    for(int i = int(last_int_hash()); i >= 0; --i) {
+        hm.hash_function(selectable_hash<Key>{int_hash(i)});
+        if(hm.hash_function().function() != int_hash(i)) {
+            throw std::runtime_error{
+                "hash_multimap::hash_function: function not replaced"};
+        }
+        hash_multimap_check_presence(hm, kvpairs,
+            "after switching to hash function " + to_string(int_hash(i)));
+    }
 }
 
 
@@ -292,7 +572,7 @@ void hash_multimap_correctness(HashMultiMap&& hm, std::size_t n, KeyValGen&& key
 template<class HashMultiMap, class KeyValGen>
 void hash_multimap_performance(HashMultiMap&& hm, std::size_t n, KeyValGen&& keyValGen)
 {
-    using value_t = std::decay_t<HashMultiMap>::value_type;
+    using value_t = typename std::decay_t<HashMultiMap>::value_type;
 
     //insert
     timer time;
@@ -312,9 +592,10 @@ void hash_multimap_performance(HashMultiMap&& hm, std::size_t n, KeyValGen&& key
 
     variance_accumulator<double> bs;
     variance_accumulator<double> pl;
-    for(const auto& b : hm) {
-        bs += b.size();
-        pl += b.probe_length();
+    for(auto it = hm.begin(); it != hm.end(); ++it) {
+        if(it->unused()) continue;
+        bs += it->size();
+        pl += hm.probe_length(it);
     }
     std::cout << "\n    bucket sizes = " << bs.mean() << " +/- " << bs.stddev();
     std::cout << "\n    probe lengths = " << pl.mean() << " +/- " << pl.stddev();
@@ -331,6 +612,19 @@ void hash_multimap_performance(HashMultiMap&& hm, std::size_t n, KeyValGen&& key
               << "    queries took " << time.milliseconds() << " ms  => "
               << ((kvpairs.size()/time.seconds())/1e6) << " Mqueries/s"
               << std::endl;
+
+    //query absent keys (most queries in practice)
+    auto absent = kvpairs;
+    for(auto& p : absent) p.first = ~p.first;
+    time.restart();
+    std::size_t found = 0;
+    for(const auto& p : absent) {
+        if(hm.find(p.first) != hm.end()) ++found;
+    }
+    time.stop();
+    std::cout << "    misses took " << time.milliseconds() << " ms  => "
+              << ((absent.size()/time.seconds())/1e6) << " Mqueries/s"
+              << "  (ignore this: " << found << ")" << std::endl;
 }
 
 
@@ -379,6 +673,57 @@ void hash_multimap_correctness()
         hm.reserve_values(n);
         hash_multimap_correctness(hm,n,k32v32);
     }
+
+    //mostly values stored in place of the bucket's array pointer
+    auto k32v32few = key_value_pair_filler<uint32_t,uint32_t>{};
+    k32v32few.values_per_key(1,2);
+    hash_multimap_correctness(hash_multimap<uint32_t,uint32_t>{},n,k32v32few);
+    auto k64v64few = key_value_pair_filler<uint64_t,uint64_t>{};
+    k64v64few.values_per_key(1,2);
+    hash_multimap_correctness(hash_multimap<uint64_t,uint64_t>{},n,k64v64few);
+
+    //bucketized cuckoo hashing
+    hash_multimap_correctness(
+        probing_hash_multimap<uint32_t,uint32_t,cuckoo_probing>{},n,k32v32);
+    hash_multimap_correctness(
+        probing_hash_multimap<uint64_t,uint64_t,cuckoo_probing>{},n,k64v64);
+    { //grow while inserting
+        probing_hash_multimap<uint32_t,uint32_t,cuckoo_probing> hm{};
+        hm.reserve_keys(n/2);
+        hash_multimap_correctness(hm,n,k32v32);
+    }
+
+    //replacing the hash function
+    hash_multimap_check_hash_switch<uint32_t,uint32_t>(n,k32v32);
+    hash_multimap_check_hash_switch<uint64_t,uint64_t>(n,k64v64);
+
+    //compact buckets with 32-bit value handles
+    hash_multimap_correctness(
+        compact_hash_multimap<uint32_t,uint32_t>{},n,k32v32);
+    //no values stored in place of the handle
+    hash_multimap_correctness(
+        compact_hash_multimap<uint64_t,uint64_t>{},n,k64v64);
+    { //grow while inserting
+        compact_hash_multimap<uint32_t,uint32_t> hm{};
+        hm.reserve_keys(n/2);
+        hash_multimap_correctness(hm,n,k32v32);
+    }
+    { //keys without values
+        compact_hash_multimap<uint64_t,uint64_t> hm{};
+        const uint64_t* none = nullptr;
+        hm.insert(42, none, none);
+        auto it = hm.find(42);
+        if(it == hm.end() || it->size() != 0 || hm.key_count() != 1) {
+            throw std::runtime_error{
+                "compact hash_multimap: key without values not found"};
+        }
+        hm.insert(42, 7);
+        it = hm.find(42);
+        if(it == hm.end() || it->size() != 1 || (*it)[0] != 7) {
+            throw std::runtime_error{
+                "compact hash_multimap: value of key not found"};
+        }
+    }
 }
 
 
@@ -406,6 +751,18 @@ void hash_multimap_performance()
     std::cout << "key: 64 bits, values: 64 bits" << std::endl;
     auto k64v64 = key_value_pair_filler<uint64_t,uint64_t>{};
     hash_multimap_performance(hash_multimap<uint64_t,uint64_t>{},n,k64v64);
+
+    std::cout << "probing schemes; key: 32 bits, values: 32 bits" << std::endl;
+    std::cout << "quadratic probing" << std::endl;
+    hash_multimap_performance(
+        probing_hash_multimap<uint32_t,uint32_t,single_pass_quadratic_probing>{},
+        n, k32v32);
+    std::cout << "linear probing" << std::endl;
+    hash_multimap_performance(
+        probing_hash_multimap<uint32_t,uint32_t,linear_probing>{}, n, k32v32);
+    std::cout << "bucketized cuckoo" << std::endl;
+    hash_multimap_performance(
+        probing_hash_multimap<uint32_t,uint32_t,cuckoo_probing>{}, n, k32v32);
 }
 
 